@@ -3,7 +3,7 @@
  * Cloning the serial port via Telnet.
  *
  * Written by Wolfgang Mattis (arduino@wm0.eu).
- * Version 1.41 / June 26, 2022.
+ * Version 1.5 / October 16, 2026.
  * MIT license, all text above must be included in any redistribution.   
  */
 
@@ -11,9 +11,13 @@
 extern "C" {
 	#include "user_interface.h"
 }
+#include <coredecls.h>
+#else
+#include <esp_heap_caps.h>
 #endif
 
 #include "TelnetSpy.h"
+#include <time.h>
 
 #ifndef min
 #define min(a,b) ((a)<(b)?(a):(b))
@@ -22,7 +26,17 @@ extern "C" {
 #define max(a,b) ((a)>(b)?(a):(b))
 #endif
 
+// States of the telnet NVT parser (per client)
+#define TELNETSPY_NVT_DATA 0		// plain data
+#define TELNETSPY_NVT_IAC 1			// IAC received
+#define TELNETSPY_NVT_OPTION 2		// WILL, WON'T, DO or DON'T received
+#define TELNETSPY_NVT_SB 3			// inside of SB ... SE
+#define TELNETSPY_NVT_SB_IAC 4		// IAC inside of SB ... SE received
+
 static TelnetSpy* actualObject = NULL;
+#ifndef ESP8266
+RTC_NOINIT_ATTR static uint8_t TelnetSpy_rtcData[TELNETSPY_RTC_STORAGE_LEN];
+#endif
 
 
 static void TelnetSpy_putc(char c) {
@@ -34,408 +48,2547 @@ static void TelnetSpy_putc(char c) {
 static void TelnetSpy_ignore_putc(char c) {;
 }
 
-TelnetSpy::TelnetSpy() {
-	port = TELNETSPY_PORT;
-	telnetServer = NULL;
-	started = false;
-	listening = false;
-	firstMainLoop = true;
-	usedSer = &Serial;
-	storeOffline = true;
-	connected = false;
-	callbackConnect = NULL;
-	callbackDisconnect = NULL;
-    callbackNvtBRK = NULL;
-    callbackNvtIP = (void(*)()) 1;  // 1 => use ESP.restart;
-    callbackNvtAO = (void(*)()) 1;  // 1 => use TelnetSpy.disconnectClient()
-    callbackNvtAYT = NULL;
-    callbackNvtEC = NULL;
-    callbackNvtEL = NULL;
-    callbackNvtGA = NULL;
-    callbackNvtWWDD = NULL;
-	welcomeMsg = strdup(TELNETSPY_WELCOME_MSG);
-	rejectMsg = strdup(TELNETSPY_REJECT_MSG);
-    filterChar = 0;
-    filterMsg = NULL;
-    filterCallback = NULL;
-	minBlockSize = TELNETSPY_MIN_BLOCK_SIZE;
-	collectingTime = TELNETSPY_COLLECTING_TIME;
-	maxBlockSize = TELNETSPY_MAX_BLOCK_SIZE;
-	pingTime = TELNETSPY_PING_TIME;
-	pingRef = 0xFFFFFFFF;
-	waitRef = 0xFFFFFFFF;
-    nvtDetected = false;
-	telnetBuf = NULL;
-	bufLen = 0;
-	uint16_t size = TELNETSPY_BUFFER_LEN;
-	while (!setBufferSize(size)) {
-		size = size >> 1;
-		if (size < minBlockSize) {
-			setBufferSize(minBlockSize);
+// Codec of the compressed backlog (LZ77 with a window of 1024 bytes). Every
+// token starts with a byte t:
+// t < 0x80: t + 1 literal bytes follow
+// t >= 0x80: copy ((t >> 2) & 0x1F) + 3 bytes from ((t & 0x03) << 8 | next
+// byte) + 1 bytes back
+
+static uint16_t TelnetSpy_pack(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t outLen, uint16_t* table) {
+	// Returns the size of the packed data or 0 if it doesn't fit into out,
+	// table is a scratch buffer of (1 << TELNETSPY_BACKLOG_HASH_BITS) entries
+	memset(table, 0xFF, sizeof(uint16_t) << TELNETSPY_BACKLOG_HASH_BITS);
+	uint16_t i = 0;
+	uint16_t lit = 0;
+	uint16_t o = 0;
+	while (i <= len) {
+		uint16_t m = 0;
+		uint16_t cand = 0xFFFF;
+		if (i + 3 <= len) {
+			uint32_t h = ((uint32_t) in[i] | (uint32_t) in[i + 1] << 8 | (uint32_t) in[i + 2] << 16) * 2654435761u;
+			h >>= 32 - TELNETSPY_BACKLOG_HASH_BITS;
+			cand = table[h];
+			table[h] = i;
+			if ((cand != 0xFFFF) && (i - cand <= 1024)) {
+				while ((i + m < len) && (m < 34) && (in[cand + m] == in[i + m])) {
+					m++;
+				}
+			}
+		}
+		if ((m < 3) && (i < len)) {
+			i++;
+			continue;
+		}
+		// Write the literals in front of the match (or at the end)
+		while (lit < i) {
+			uint8_t n = min(i - lit, 128);
+			if (o + 1 + n > outLen) {
+				return 0;
+			}
+			out[o++] = n - 1;
+			memcpy(&out[o], &in[lit], n);
+			o += n;
+			lit += n;
+		}
+		if (i == len) {
 			break;
 		}
+		if (o + 2 > outLen) {
+			return 0;
+		}
+		uint16_t dist = i - cand - 1;
+		out[o++] = 0x80 | ((m - 3) << 2) | (dist >> 8);
+		out[o++] = dist & 0xFF;
+		i += m;
+		lit = i;
 	}
-	recBuf = NULL;
-	recLen = 0;
-    setRecBufferSize(TELNETSPY_REC_BUFFER_LEN);
-	debugOutput = TELNETSPY_CAPTURE_OS_PRINT;
-	if (debugOutput) {
-		setDebugOutput(true);
-	}
-}
-
-TelnetSpy::~TelnetSpy() {
-	end();
-	if (welcomeMsg) free(welcomeMsg);
-	if (rejectMsg) free(rejectMsg);
-    if (filterMsg) free(filterMsg);
-	if (telnetBuf) free(telnetBuf);
-	if (recBuf) free(recBuf);
+	return o;
 }
 
-void TelnetSpy::setPort(uint16_t portToUse) {
-	port = portToUse;
-	if (listening) {
-		if (client.connected()) {
-            sendBlock();
-			client.flush();
-			client.stop();
-		}
-		if (connected && (callbackDisconnect != NULL)) {
-			callbackDisconnect();
-		}
-		connected = false;
-		telnetServer->close();
-		delete telnetServer;
-		telnetServer = new WiFiServer(port);
-		if (started) {
-			telnetServer->begin();
-			telnetServer->setNoDelay(bufLen > 0);
+static uint16_t TelnetSpy_unpack(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t outLen) {
+	// Returns the size of the unpacked data
+	uint16_t i = 0;
+	uint16_t o = 0;
+	while (i < len) {
+		uint8_t t = in[i++];
+		if (t < 0x80) {
+			uint16_t n = t + 1;
+			if ((i + n > len) || (o + n > outLen)) {
+				break;
+			}
+			memcpy(&out[o], &in[i], n);
+			i += n;
+			o += n;
+		} else {
+			if (i >= len) {
+				break;
+			}
+			uint16_t n = ((t >> 2) & 0x1F) + 3;
+			uint16_t dist = (((t & 0x03) << 8) | in[i++]) + 1;
+			if ((dist > o) || (o + n > outLen)) {
+				break;
+			}
+			// The source may overlap the destination, so copy byte by byte
+			for (uint16_t k = 0; k < n; k++, o++) {
+				out[o] = out[o - dist];
+			}
 		}
 	}
+	return o;
 }
 
-void TelnetSpy::setWelcomeMsg(const char* msg) {
-	if (welcomeMsg) {
-		free(welcomeMsg);
+static void* TelnetSpy_realloc(void* ptr, size_t size, bool external) {
+	// On ESP32 the buffer is put into the external RAM (PSRAM) if requested,
+	// else into the internal one. If the requested RAM is missing or full,
+	// any memory of the heap is used.
+#ifndef ESP8266
+	void* temp = heap_caps_realloc(ptr, size, (external ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL) | MALLOC_CAP_8BIT);
+	if (temp) {
+		return temp;
 	}
-	welcomeMsg = strdup(msg);
+#endif
+	return realloc(ptr, size);
 }
 
-void TelnetSpy::setWelcomeMsg(const String& msg) {
-	if (welcomeMsg) {
-		free(welcomeMsg);
+static void TelnetSpy_reverse(char* data, size_t len) {
+	for (size_t i = 0; i < (len >> 1); i++) {
+		char c = data[i];
+		data[i] = data[len - 1 - i];
+		data[len - 1 - i] = c;
 	}
-	welcomeMsg = strdup(msg.c_str());
 }
 
-void TelnetSpy::setRejectMsg(const char* msg) {
-	if (rejectMsg) {
-		free(rejectMsg);
+static void TelnetSpy_setMsg(const char** msg, bool* inFlash, const char* newMsg, bool flash) {
+	// A message in flash is used directly, other ones are copied
+	if (*msg && !*inFlash) {
+		free((void*) *msg);
 	}
-	rejectMsg = strdup(msg);
+	*msg = (flash || !newMsg) ? newMsg : strdup(newMsg);
+	*inFlash = flash;
 }
 
-void TelnetSpy::setRejectMsg(const String& msg) {
-	if (rejectMsg) {
-		free(rejectMsg);
+static uint32_t TelnetSpy_checksum(uint32_t sum, const uint8_t* data, uint16_t len) {
+	// FNV-1a
+	while (len--) {
+		sum = (sum ^ *data++) * 16777619;
 	}
-	rejectMsg = strdup(msg.c_str());
+	return sum;
 }
 
-void TelnetSpy::setMinBlockSize(uint16_t minSize) {
-	minBlockSize = min(max((uint16_t) 1, minSize), maxBlockSize);
-}
-    
-void TelnetSpy::setCollectingTime(uint16_t colTime) {
-	collectingTime = colTime;
+TelnetSpyRtcStorage::TelnetSpyRtcStorage(uint16_t offset, uint16_t size) {
+	start = min(offset, (uint16_t) TELNETSPY_RTC_STORAGE_LEN);
+	length = min(size, (uint16_t) (TELNETSPY_RTC_STORAGE_LEN - start));
 }
 
-void TelnetSpy::setMaxBlockSize(uint16_t maxSize) {
-	maxBlockSize = max(maxSize, minBlockSize);
+uint16_t TelnetSpyRtcStorage::size() {
+	return length;
 }
 
-bool TelnetSpy::setBufferSize(uint16_t newSize) {
-	if (telnetBuf && (bufLen == newSize)) {
-		return true;
-	}
-	if (newSize == 0) {
-		bufLen = 0;
-		if (telnetBuf) {
-			free(telnetBuf);
-			telnetBuf = NULL;
-		}
-		if (telnetServer) {
-			telnetServer->setNoDelay(false);
-		}
-		return true;
+#ifdef ESP8266
+// The RTC user memory starts at block 64 and is accessed in blocks of 4 bytes
+bool TelnetSpyRtcStorage::read(uint16_t offset, uint8_t* data, uint16_t len) {
+	if (((start + offset) & 3) || (offset + len > length)) {
+		return false;
 	}
-	newSize = max(newSize, minBlockSize);
-	uint16_t oldBufLen = bufLen;
-	bufLen = newSize;
-	uint16_t tmp;
-	if (!telnetBuf || (bufUsed == 0)) {
-		bufRdIdx = 0;
-		bufWrIdx = 0;
-		bufUsed = 0;
-	} else {
-		if (bufLen < oldBufLen) {
-			if (bufRdIdx < bufWrIdx) {
-				if (bufWrIdx > bufLen) {
-					tmp = min(bufLen, (uint16_t) (bufWrIdx - max(bufLen, bufRdIdx)));
-					memcpy(telnetBuf, &telnetBuf[bufWrIdx - tmp], tmp);
-					bufWrIdx = tmp;
-					if (bufWrIdx > bufRdIdx) {
-						bufRdIdx = bufWrIdx;
-					} else {
-						if (bufRdIdx > bufLen) {
-							bufRdIdx = 0;
-						}
-					}
-					if (bufRdIdx == bufWrIdx) {
-						bufUsed = bufLen;
-					} else {
-						bufUsed = bufWrIdx - bufRdIdx;
-					}
-				}
-			} else {
-				if (bufWrIdx > bufLen) {
-					memcpy(telnetBuf, &telnetBuf[bufWrIdx - bufLen], bufLen);
-					bufRdIdx = 0;
-					bufWrIdx = 0;
-					bufUsed = bufLen;
-				} else {
-					tmp = min(bufLen - bufWrIdx, oldBufLen - bufRdIdx);
-					memcpy(&telnetBuf[bufLen - tmp], &telnetBuf[oldBufLen - tmp], tmp);
-					bufRdIdx = bufLen - tmp;
-					bufUsed = bufWrIdx + tmp;
-				}
-			}
+	uint32_t word;
+	for (uint16_t i = 0; i < len; i += 4) {
+		if (!system_rtc_mem_read(64 + ((start + offset + i) >> 2), &word, 4)) {
+			return false;
 		}
+		memcpy(&data[i], &word, min((uint16_t) 4, (uint16_t) (len - i)));
 	}
-	char* temp = (char*) realloc(telnetBuf, bufLen);
-	if (!temp) {
+	return true;
+}
+
+bool TelnetSpyRtcStorage::write(uint16_t offset, const uint8_t* data, uint16_t len) {
+	if (((start + offset) & 3) || (offset + ((len + 3) & ~3) > length)) {
 		return false;
 	}
-	telnetBuf = temp;
-	if (telnetBuf && (bufLen > oldBufLen) && (bufRdIdx > bufWrIdx)) {
-		tmp = bufLen - (oldBufLen - bufRdIdx);
-		memcpy(&telnetBuf[tmp], &telnetBuf[bufRdIdx], oldBufLen - bufRdIdx);
-		bufRdIdx = tmp;
+	uint32_t word = 0;
+	for (uint16_t i = 0; i < len; i += 4) {
+		memcpy(&word, &data[i], min((uint16_t) 4, (uint16_t) (len - i)));
+		if (!system_rtc_mem_write(64 + ((start + offset + i) >> 2), &word, 4)) {
+			return false;
+		}
 	}
-	if (telnetServer) {
-		telnetServer->setNoDelay(true);
+	return true;
+}
+#else	// ESP32
+bool TelnetSpyRtcStorage::read(uint16_t offset, uint8_t* data, uint16_t len) {
+	if (offset + len > length) {
+		return false;
 	}
+	memcpy(data, &TelnetSpy_rtcData[start + offset], len);
 	return true;
 }
 
-uint16_t TelnetSpy::getBufferSize() {
-	if (!telnetBuf) {
-		return 0;
+bool TelnetSpyRtcStorage::write(uint16_t offset, const uint8_t* data, uint16_t len) {
+	if (offset + len > length) {
+		return false;
 	}
-	return bufLen;
+	memcpy(&TelnetSpy_rtcData[start + offset], data, len);
+	return true;
 }
+#endif
 
-void TelnetSpy::setStoreOffline(bool store) {
-	storeOffline = store;
+TelnetSpyFileStorage::TelnetSpyFileStorage(fs::FS& fileSystem, const char* fileName, uint16_t size)
+		: fileSys(fileSystem) {
+	path = strdup(fileName);
+	length = size;
 }
 
-bool TelnetSpy::getStoreOffline() {
-	return storeOffline;
+TelnetSpyFileStorage::~TelnetSpyFileStorage() {
+	if (path) free(path);
 }
 
-void TelnetSpy::setPingTime(uint16_t pngTime) {
-	pingTime = pngTime;
-	if (pingTime == 0) {
-		pingRef = 0xFFFFFFFF;
-	} else {
-		pingRef = (millis() & 0x7FFFFFF) + pingTime;
-	}
+uint16_t TelnetSpyFileStorage::size() {
+	return length;
 }
 
-bool TelnetSpy::setRecBufferSize(uint16_t newSize) {
-	if (recBuf && (recLen == newSize)) {
-		return true;
-	}
-	if (recBuf) {
-		free(recBuf);
-		recBuf = NULL;
-        recLen = 0;
-	}
-	if (newSize == 0) {
-		return true;
+bool TelnetSpyFileStorage::read(uint16_t offset, uint8_t* data, uint16_t len) {
+	if (!path || (offset + len > length) || !fileSys.exists(path)) {
+		return false;
 	}
-	recBuf = (char*) malloc(newSize);
-	if (!recBuf) {
+	File file = fileSys.open(path, "r");
+	if (!file) {
 		return false;
-    }
-    recLen = newSize;
-	recRdIdx = 0;
-	recWrIdx = 0;
-	recUsed = 0;
-	return true;
-}
-
-uint16_t TelnetSpy::getRecBufferSize() {
-	if (!recBuf) {
-		return 0;
 	}
-	return recLen;
-}
-
-void TelnetSpy::setSerial(HardwareSerial* usedSerial) {
-	usedSer = usedSerial;
+	bool result = file.seek(offset) && (file.read(data, len) == len);
+	file.close();
+	return result;
 }
 
-size_t TelnetSpy::write (uint8_t data) {
-	if (telnetBuf) {
-		if (storeOffline || client.connected()) {
-			if (bufUsed == bufLen) {
-				if (client.connected()) {
-					sendBlock();
-				}
-				if (bufUsed == bufLen) {
-					char c;
-					while (bufUsed > 0) {
-						c = pullTelnetBuf();
-						if (c == '\n') {
-							break;
-						}
-					}
-					if (peekTelnetBuf() == '\r') {
-						pullTelnetBuf();
-					}
-				}
-			}
-			addTelnetBuf(data);
+bool TelnetSpyFileStorage::write(uint16_t offset, const uint8_t* data, uint16_t len) {
+	if (!path || (offset + len > length)) {
+		return false;
+	}
+	if (!fileSys.exists(path)) {
+		// Create the file with its full size, so every offset can be written
+		File file = fileSys.open(path, "w");
+		if (!file) {
+			return false;
 		}
-	} else {
-		if (client.connected()) {
-			client.write(data);
+		uint8_t zero[16] = { 0 };
+		for (uint16_t i = 0; i < length; i += sizeof(zero)) {
+			file.write(zero, min((uint16_t) sizeof(zero), (uint16_t) (length - i)));
 		}
+		file.close();
 	}
-	if ((NULL != usedSer) && *usedSer) {
-		return usedSer->write(data);
+	File file = fileSys.open(path, "r+");
+	if (!file) {
+		return false;
 	}
-	return 1;
+	bool result = file.seek(offset) && (file.write(data, len) == len);
+	file.close();
+	return result;
 }
 
-void TelnetSpy::debugWrite (uint8_t data) {
-	if (telnetBuf) {
-		if (storeOffline || client.connected()) {
-			if (bufUsed == bufLen) {
-				char c;
-				while (bufUsed > 0) {
-					c = pullTelnetBuf();
-					if (c == '\n') {
-						break;
-					}
-				}
-				if (peekTelnetBuf() == '\r') {
-					pullTelnetBuf();
-				}
-			}
-			addTelnetBuf(data);
-		}
+static bool TelnetSpy_networkReady() {
+	switch (WiFi.getMode()) {
+		case WIFI_MODE_STA:
+			return WiFi.status() == WL_CONNECTED;
+		case WIFI_MODE_AP:
+		case WIFI_MODE_APSTA:
+			return true;
+		default:
+			return false;
 	}
-#ifdef ESP8266
-    ets_putc(data);
-#else
-    ets_write_char_uart(data);
-#endif
 }
 
-int TelnetSpy::available (void) {
-	if (usedSer) {
-		int avail = usedSer->available();
-		if (avail > 0) {
-			return avail;
-		}
-	}
-	if (client.connected()) {
-		return telnetAvailable();
-	}
-	return 0;
+TelnetSpyWiFiTransport::TelnetSpyWiFiTransport() {
+	server = NULL;
+	noDelay = false;
 }
 
-int TelnetSpy::read (void) {
-	int val = -1;
-	if (usedSer) {
-		val = usedSer->read();
-		if (val != -1) {
-			return val;
-		}
-	}
-	if (client.connected()) {
-		if (telnetAvailable()) {
-            if (recBuf) {
-                if (recUsed == 0) {
-                    val = -1;
-                } else {
-CRITCAL_SECTION_START
-                    val = recBuf[recRdIdx++];
-	                if (recRdIdx >= recLen) {
-		                recRdIdx = 0;
-	                }
-	                recUsed--;
-CRITCAL_SECTION_END
-                }
-            } else {
-			    val = client.read();
-            }
-		}
+TelnetSpyWiFiTransport::~TelnetSpyWiFiTransport() {
+	end();
+}
+
+bool TelnetSpyWiFiTransport::begin(uint16_t port) {
+	if (!TelnetSpy_networkReady()) {
+		return false;
 	}
-	return val;
+	end();
+	server = new WiFiServer(port);
+	server->begin();
+	server->setNoDelay(noDelay);
+	return true;
 }
 
-int TelnetSpy::peek (void) {
-	int val = -1;
-	if (usedSer) {
-		val = usedSer->peek();
-		if (val != -1) {
-			return val;
-		}
+void TelnetSpyWiFiTransport::end() {
+	for (uint8_t i = 0; i < TELNETSPY_TRANSPORT_SLOTS; i++) {
+		clients[i].stop();
 	}
-	if (client.connected()) {
-		if (telnetAvailable()) {
-            if (recBuf) {
-                val = recBuf[recRdIdx];
-            } else {
-			    val = client.peek();
-            }
-		}
+	if (server) {
+		server->close();
+		delete server;
+		server = NULL;
 	}
-	return val;
 }
 
-void TelnetSpy::flush (void) {
-	if (usedSer) {
-		usedSer->flush();
+void TelnetSpyWiFiTransport::setNoDelay(bool noDelay) {
+	this->noDelay = noDelay;
+	if (server) {
+		server->setNoDelay(noDelay);
 	}
-	if (client.connected()) {
-        sendBlock();
-        client.flush();
-    }
 }
 
-#ifdef ESP8266
+bool TelnetSpyWiFiTransport::hasClient() {
+	return server && server->hasClient();
+}
 
-void TelnetSpy::begin(unsigned long baud, SerialConfig config, SerialMode mode, uint8_t tx_pin) {
-	if (usedSer) {
-		usedSer->begin(baud, config, mode, tx_pin);
+bool TelnetSpyWiFiTransport::accept(uint8_t slot) {
+	if (!server) {
+		return false;
 	}
-    setDebugOutput(debugOutput);
-	started = true;
+	clients[slot] = server->available();
+	return clients[slot].connected();
 }
 
-#else // ESP32
-
-void TelnetSpy::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert) {
-	if (usedSer) {
-		usedSer->begin(baud, config, rxPin, txPin, invert);
-	}
-    setDebugOutput(debugOutput);
-	started = true;
+bool TelnetSpyWiFiTransport::connected(uint8_t slot) {
+	return clients[slot].connected();
+}
+
+int TelnetSpyWiFiTransport::availableForWrite(uint8_t slot) {
+#ifdef ESP8266
+	return clients[slot].availableForWrite();
+#else
+	// The WiFiClient of ESP32 doesn't report its free space
+	return -1;
+#endif
+}
+
+size_t TelnetSpyWiFiTransport::write(uint8_t slot, const uint8_t* data, size_t len) {
+	return clients[slot].write(data, len);
+}
+
+int TelnetSpyWiFiTransport::available(uint8_t slot) {
+	return clients[slot].available();
+}
+
+int TelnetSpyWiFiTransport::read(uint8_t slot, uint8_t* data, size_t len) {
+	return clients[slot].read(data, len);
+}
+
+int TelnetSpyWiFiTransport::peek(uint8_t slot) {
+	return clients[slot].peek();
+}
+
+void TelnetSpyWiFiTransport::flush(uint8_t slot) {
+	clients[slot].flush();
+}
+
+void TelnetSpyWiFiTransport::stop(uint8_t slot) {
+	clients[slot].stop();
+}
+
+#ifdef TELNETSPY_ASYNC_TCP
+// The callbacks of AsyncTCP run in its own task on ESP32, so the clients and
+// their receive buffers are guarded by a mutex. A client is deleted only by
+// its disconnect callback. The slot TELNETSPY_TRANSPORT_SLOTS buffers the data
+// of the pending connection.
+
+TelnetSpyAsyncTransport::TelnetSpyAsyncTransport() {
+	server = NULL;
+	pending = NULL;
+	noDelay = false;
+	for (uint8_t i = 0; i <= TELNETSPY_TRANSPORT_SLOTS; i++) {
+		if (i < TELNETSPY_TRANSPORT_SLOTS) {
+			clients[i] = NULL;
+		}
+		recRdIdx[i] = 0;
+		recUsed[i] = 0;
+	}
+#ifndef ESP8266
+	mutex = xSemaphoreCreateMutex();
+#endif
+}
+
+TelnetSpyAsyncTransport::~TelnetSpyAsyncTransport() {
+	end();
+#ifndef ESP8266
+	if (mutex) vSemaphoreDelete(mutex);
+#endif
+}
+
+void TelnetSpyAsyncTransport::lock() {
+#ifndef ESP8266
+	xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+}
+
+void TelnetSpyAsyncTransport::unlock() {
+#ifndef ESP8266
+	xSemaphoreGive(mutex);
+#endif
+}
+
+bool TelnetSpyAsyncTransport::begin(uint16_t port) {
+	end();
+	server = new AsyncServer(port);
+	server->onClient([](void* arg, AsyncClient* client) {
+		((TelnetSpyAsyncTransport*) arg)->onConnect(client);
+	}, this);
+	server->setNoDelay(noDelay);
+	server->begin();
+	return true;
+}
+
+void TelnetSpyAsyncTransport::end() {
+	if (server) {
+		server->end();
+		delete server;
+		server = NULL;
+	}
+	for (uint8_t i = 0; i <= TELNETSPY_TRANSPORT_SLOTS; i++) {
+		lock();
+		AsyncClient* client = (i < TELNETSPY_TRANSPORT_SLOTS) ? clients[i] : pending;
+		if (i < TELNETSPY_TRANSPORT_SLOTS) {
+			clients[i] = NULL;
+		} else {
+			pending = NULL;
+		}
+		unlock();
+		if (client) {
+			// The transport may be deleted before the client is closed
+			client->onData(NULL, NULL);
+			client->onDisconnect([](void* arg, AsyncClient* client) {
+				delete client;
+			}, NULL);
+			client->close(true);
+		}
+	}
+}
+
+void TelnetSpyAsyncTransport::setNoDelay(bool noDelay) {
+	this->noDelay = noDelay;
+	if (server) {
+		server->setNoDelay(noDelay);
+	}
+}
+
+void TelnetSpyAsyncTransport::onConnect(AsyncClient* client) {
+	client->onData([](void* arg, AsyncClient* client, void* data, size_t len) {
+		((TelnetSpyAsyncTransport*) arg)->onData(client, (const uint8_t*) data, len);
+	}, this);
+	client->onDisconnect([](void* arg, AsyncClient* client) {
+		((TelnetSpyAsyncTransport*) arg)->onDisconnect(client);
+	}, this);
+	client->setNoDelay(noDelay);
+	lock();
+	bool busy = (pending != NULL);
+	if (!busy) {
+		pending = client;
+		recRdIdx[TELNETSPY_TRANSPORT_SLOTS] = 0;
+		recUsed[TELNETSPY_TRANSPORT_SLOTS] = 0;
+	}
+	unlock();
+	if (busy) {
+		// Only one connection waits for handle()
+		client->close(true);
+	} else {
+		wakeup();
+	}
+}
+
+void TelnetSpyAsyncTransport::onData(AsyncClient* client, const uint8_t* data, size_t len) {
+	lock();
+	uint8_t slot = 0;
+	while ((slot < TELNETSPY_TRANSPORT_SLOTS) && (clients[slot] != client)) {
+		slot++;
+	}
+	if ((slot < TELNETSPY_TRANSPORT_SLOTS) || (pending == client)) {
+		// Data which doesn't fit until the next handle() is lost
+		len = min(len, (size_t) (TELNETSPY_TRANSPORT_REC_LEN - recUsed[slot]));
+		uint16_t pos = (recRdIdx[slot] + recUsed[slot]) % TELNETSPY_TRANSPORT_REC_LEN;
+		uint16_t tmp = min(len, (size_t) (TELNETSPY_TRANSPORT_REC_LEN - pos));
+		memcpy(&recBuf[slot][pos], data, tmp);
+		memcpy(recBuf[slot], &data[tmp], len - tmp);
+		recUsed[slot] += len;
+	}
+	unlock();
+	wakeup();
+}
+
+void TelnetSpyAsyncTransport::onDisconnect(AsyncClient* client) {
+	lock();
+	if (pending == client) {
+		pending = NULL;
+	}
+	for (uint8_t i = 0; i < TELNETSPY_TRANSPORT_SLOTS; i++) {
+		if (clients[i] == client) {
+			clients[i] = NULL;
+		}
+	}
+	unlock();
+	delete client;
+	wakeup();
+}
+
+bool TelnetSpyAsyncTransport::hasClient() {
+	return pending != NULL;
+}
+
+bool TelnetSpyAsyncTransport::accept(uint8_t slot) {
+	lock();
+	AsyncClient* old = clients[slot];
+	clients[slot] = pending;
+	pending = NULL;
+	memcpy(recBuf[slot], recBuf[TELNETSPY_TRANSPORT_SLOTS], TELNETSPY_TRANSPORT_REC_LEN);
+	recRdIdx[slot] = recRdIdx[TELNETSPY_TRANSPORT_SLOTS];
+	recUsed[slot] = recUsed[TELNETSPY_TRANSPORT_SLOTS];
+	bool result = (clients[slot] != NULL);
+	unlock();
+	if (old) {
+		old->close(true);
+	}
+	return result;
+}
+
+bool TelnetSpyAsyncTransport::connected(uint8_t slot) {
+	lock();
+	bool result = clients[slot] && clients[slot]->connected();
+	unlock();
+	return result;
+}
+
+int TelnetSpyAsyncTransport::availableForWrite(uint8_t slot) {
+	lock();
+	int result = clients[slot] ? clients[slot]->space() : 0;
+	unlock();
+	return result;
+}
+
+size_t TelnetSpyAsyncTransport::write(uint8_t slot, const uint8_t* data, size_t len) {
+	lock();
+	AsyncClient* client = clients[slot];
+	if (client) {
+		len = min(len, client->space());
+		if (len > 0) {
+			len = client->add((const char*) data, len, ASYNC_WRITE_FLAG_COPY);
+			client->send();
+		}
+	} else {
+		len = 0;
+	}
+	unlock();
+	return len;
+}
+
+int TelnetSpyAsyncTransport::available(uint8_t slot) {
+	return recUsed[slot];
+}
+
+int TelnetSpyAsyncTransport::read(uint8_t slot, uint8_t* data, size_t len) {
+	lock();
+	len = min(len, (size_t) recUsed[slot]);
+	uint16_t tmp = min(len, (size_t) (TELNETSPY_TRANSPORT_REC_LEN - recRdIdx[slot]));
+	memcpy(data, &recBuf[slot][recRdIdx[slot]], tmp);
+	memcpy(&data[tmp], recBuf[slot], len - tmp);
+	recRdIdx[slot] = (recRdIdx[slot] + len) % TELNETSPY_TRANSPORT_REC_LEN;
+	recUsed[slot] -= len;
+	unlock();
+	return len;
+}
+
+int TelnetSpyAsyncTransport::peek(uint8_t slot) {
+	lock();
+	int result = recUsed[slot] ? recBuf[slot][recRdIdx[slot]] : -1;
+	unlock();
+	return result;
+}
+
+void TelnetSpyAsyncTransport::stop(uint8_t slot) {
+	lock();
+	AsyncClient* client = clients[slot];
+	clients[slot] = NULL;
+	recUsed[slot] = 0;
+	unlock();
+	if (client) {
+		// The data already added is still sent
+		client->close();
+	}
+}
+#endif
+
+TelnetSpyLoopbackTransport::TelnetSpyLoopbackTransport(size_t window) {
+	winLen = window;
+	pending = 0;
+	for (uint8_t i = 0; i < TELNETSPY_TRANSPORT_SLOTS; i++) {
+		open[i] = false;
+		outBuf[i] = window ? (uint8_t*) malloc(window) : NULL;
+		outUsed[i] = 0;
+		sent[i] = 0;
+		inRdIdx[i] = 0;
+		inUsed[i] = 0;
+	}
+}
+
+TelnetSpyLoopbackTransport::~TelnetSpyLoopbackTransport() {
+	for (uint8_t i = 0; i < TELNETSPY_TRANSPORT_SLOTS; i++) {
+		if (outBuf[i]) free(outBuf[i]);
+	}
+}
+
+void TelnetSpyLoopbackTransport::connectClient() {
+	pending++;
+	wakeup();
+}
+
+void TelnetSpyLoopbackTransport::disconnectClient(uint8_t slot) {
+	if (slot < TELNETSPY_TRANSPORT_SLOTS) {
+		open[slot] = false;
+	}
+	wakeup();
+}
+
+size_t TelnetSpyLoopbackTransport::input(uint8_t slot, const uint8_t* data, size_t len) {
+	// Returns the number of bytes which fit into the receive buffer
+	if ((slot >= TELNETSPY_TRANSPORT_SLOTS) || !open[slot]) {
+		return 0;
+	}
+	len = min(len, (size_t) (TELNETSPY_TRANSPORT_REC_LEN - inUsed[slot]));
+	for (size_t i = 0; i < len; i++) {
+		inBuf[slot][(inRdIdx[slot] + inUsed[slot] + i) % TELNETSPY_TRANSPORT_REC_LEN] = data[i];
+	}
+	inUsed[slot] += len;
+	wakeup();
+	return len;
+}
+
+size_t TelnetSpyLoopbackTransport::output(uint8_t slot, uint8_t* data, size_t len) {
+	// Removes the oldest sent data (data may be NULL to drop it)
+	if ((slot >= TELNETSPY_TRANSPORT_SLOTS) || !outBuf[slot]) {
+		return 0;
+	}
+	len = min(len, outUsed[slot]);
+	if (data) {
+		memcpy(data, outBuf[slot], len);
+	}
+	memmove(outBuf[slot], &outBuf[slot][len], outUsed[slot] - len);
+	outUsed[slot] -= len;
+	return len;
+}
+
+uint32_t TelnetSpyLoopbackTransport::getSent(uint8_t slot) {
+	return (slot < TELNETSPY_TRANSPORT_SLOTS) ? sent[slot] : 0;
+}
+
+bool TelnetSpyLoopbackTransport::begin(uint16_t port) {
+	return true;
+}
+
+void TelnetSpyLoopbackTransport::end() {
+	pending = 0;
+	for (uint8_t i = 0; i < TELNETSPY_TRANSPORT_SLOTS; i++) {
+		open[i] = false;
+	}
+}
+
+bool TelnetSpyLoopbackTransport::hasClient() {
+	return pending > 0;
+}
+
+bool TelnetSpyLoopbackTransport::accept(uint8_t slot) {
+	if (pending == 0) {
+		return false;
+	}
+	pending--;
+	open[slot] = true;
+	outUsed[slot] = 0;
+	sent[slot] = 0;
+	inRdIdx[slot] = 0;
+	inUsed[slot] = 0;
+	return true;
+}
+
+bool TelnetSpyLoopbackTransport::connected(uint8_t slot) {
+	return open[slot];
+}
+
+int TelnetSpyLoopbackTransport::availableForWrite(uint8_t slot) {
+	return outBuf[slot] ? winLen - outUsed[slot] : -1;
+}
+
+size_t TelnetSpyLoopbackTransport::write(uint8_t slot, const uint8_t* data, size_t len) {
+	if (!open[slot]) {
+		return 0;
+	}
+	if (outBuf[slot]) {
+		len = min(len, winLen - outUsed[slot]);
+		memcpy(&outBuf[slot][outUsed[slot]], data, len);
+		outUsed[slot] += len;
+	} else if (winLen) {
+		// The window couldn't be allocated
+		return 0;
+	}
+	sent[slot] += len;
+	return len;
+}
+
+int TelnetSpyLoopbackTransport::available(uint8_t slot) {
+	return inUsed[slot];
+}
+
+int TelnetSpyLoopbackTransport::read(uint8_t slot, uint8_t* data, size_t len) {
+	len = min(len, (size_t) inUsed[slot]);
+	for (size_t i = 0; i < len; i++) {
+		data[i] = inBuf[slot][inRdIdx[slot]];
+		inRdIdx[slot] = (inRdIdx[slot] + 1) % TELNETSPY_TRANSPORT_REC_LEN;
+	}
+	inUsed[slot] -= len;
+	return len;
+}
+
+int TelnetSpyLoopbackTransport::peek(uint8_t slot) {
+	return inUsed[slot] ? inBuf[slot][inRdIdx[slot]] : -1;
+}
+
+void TelnetSpyLoopbackTransport::stop(uint8_t slot) {
+	open[slot] = false;
+}
+
+// The syslog severities of TELNETSPY_SEVERITY_DEBUG ... TELNETSPY_SEVERITY_ERROR
+static const uint8_t TelnetSpy_syslogSeverity[] = { 7, 6, 4, 3 };
+
+TelnetSpySyslogTransport::TelnetSpySyslogTransport(IPAddress server, uint16_t port, const char* hostname,
+		const char* appName) {
+	serverIp = server;
+	serverPort = port;
+	// The header must fit into TELNETSPY_SYSLOG_HEADER_LEN, so the names are cut
+	host = hostname ? strndup(hostname, 40) : NULL;
+	app = strndup(appName ? appName : "-", 40);
+	packet = NULL;
+	mtu = 0;
+	textLen = 0;
+	level = TELNETSPY_SEVERITY_INFO;
+	iacState = 0;
+	rate = TELNETSPY_SYSLOG_RATE;
+	tokens = rate;
+	tokenRef = millis();
+	openSlot = 0xFF;
+	datagrams = 0;
+	setMtu(TELNETSPY_SYSLOG_MTU);
+}
+
+TelnetSpySyslogTransport::~TelnetSpySyslogTransport() {
+	if (packet) free(packet);
+	if (host) free(host);
+	if (app) free(app);
+}
+
+bool TelnetSpySyslogTransport::setMtu(uint16_t newMtu) {
+	// The text of a datagram is limited by the longest possible header:
+	// "<PRI>1 TIMESTAMP HOSTNAME APP-NAME - - - "
+	uint16_t header = 7 + 21 + (host ? strlen(host) : 15) + 1 + (app ? strlen(app) : 1) + 7;
+	if ((newMtu <= header + 16) || !app) {
+		return false;
+	}
+	char* temp = (char*) realloc(packet, TELNETSPY_SYSLOG_HEADER_LEN + newMtu - header);
+	if (!temp) {
+		return false;
+	}
+	packet = temp;
+	mtu = newMtu;
+	textMax = newMtu - header;
+	// The waiting text is cut
+	if (textLen > textMax) {
+		textLen = textMax;
+	}
+	return true;
+}
+
+void TelnetSpySyslogTransport::setRateLimit(uint16_t perSecond) {
+	rate = perSecond;
+	tokens = rate;
+	tokenRef = millis();
+}
+
+uint32_t TelnetSpySyslogTransport::getDatagramCount() {
+	return datagrams;
+}
+
+void TelnetSpySyslogTransport::refillTokens() {
+	// Token bucket: "rate" datagrams per second, up to one second in a burst
+	unsigned long elapsed = millis() - tokenRef;
+	if (elapsed >= 1000) {
+		tokens = rate;
+		tokenRef = millis();
+	} else {
+		uint16_t add = elapsed * rate / 1000;
+		if (add > 0) {
+			tokens = min((uint16_t) (tokens + add), rate);
+			tokenRef += (unsigned long) add * 1000 / rate;
+		}
+	}
+}
+
+bool TelnetSpySyslogTransport::takeToken() {
+	if (rate == 0) {
+		return true;
+	}
+	refillTokens();
+	if (tokens == 0) {
+		return false;
+	}
+	tokens--;
+	return true;
+}
+
+bool TelnetSpySyslogTransport::sendLine() {
+	// Sends the waiting text as one message, returns false if there is no
+	// token for its datagram
+	if (textLen == 0) {
+		return true;
+	}
+	if (!takeToken()) {
+		return false;
+	}
+	char header[TELNETSPY_SYSLOG_HEADER_LEN];
+	char stamp[24] = "-";
+	time_t now = time(NULL);
+	if (now > 1600000000) {
+		// The time is synchronized
+		struct tm t;
+		gmtime_r(&now, &t);
+		strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &t);
+	}
+	unsigned pri = TELNETSPY_SYSLOG_FACILITY * 8 + TelnetSpy_syslogSeverity[level];
+	int len;
+	if (host) {
+		len = snprintf(header, sizeof(header), "<%u>1 %s %s %s - - - ", pri, stamp, host, app);
+	} else {
+		IPAddress ip = WiFi.localIP();
+		len = snprintf(header, sizeof(header), "<%u>1 %s %u.%u.%u.%u %s - - - ", pri, stamp,
+				ip[0], ip[1], ip[2], ip[3], app);
+	}
+	len = min(len, (int) sizeof(header) - 1);
+	// The header is put in front of the text
+	char* text = &packet[TELNETSPY_SYSLOG_HEADER_LEN];
+	memcpy(text - len, header, len);
+	udp.beginPacket(serverIp, serverPort);
+	udp.write((const uint8_t*) text - len, len + textLen);
+	udp.endPacket();
+	datagrams++;
+	textLen = 0;
+	return true;
+}
+
+bool TelnetSpySyslogTransport::begin(uint16_t port) {
+	// The telnet port isn't used
+	return TelnetSpy_networkReady();
+}
+
+void TelnetSpySyslogTransport::end() {
+	if (openSlot != 0xFF) {
+		stop(openSlot);
+	}
+}
+
+bool TelnetSpySyslogTransport::hasClient() {
+	return (openSlot == 0xFF) && packet && TelnetSpy_networkReady();
+}
+
+bool TelnetSpySyslogTransport::accept(uint8_t slot) {
+	if (!hasClient() || (slot >= TELNETSPY_MAX_CLIENTS)) {
+		return false;
+	}
+	openSlot = slot;
+	textLen = 0;
+	level = TELNETSPY_SEVERITY_INFO;
+	iacState = 0;
+	return true;
+}
+
+bool TelnetSpySyslogTransport::connected(uint8_t slot) {
+	return (slot == openSlot) && TelnetSpy_networkReady();
+}
+
+int TelnetSpySyslogTransport::availableForWrite(uint8_t slot) {
+	// Without a token nothing is taken, so the data waits in the transmit buffer
+	if (rate) {
+		refillTokens();
+		if (tokens == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+size_t TelnetSpySyslogTransport::write(uint8_t slot, const uint8_t* data, size_t len) {
+	if (!connected(slot)) {
+		return 0;
+	}
+	char* text = &packet[TELNETSPY_SYSLOG_HEADER_LEN];
+	size_t pos = 0;
+	for (; pos < len; pos++) {
+		uint8_t c = data[pos];
+		if (iacState) {
+			if ((iacState == 1) && (c <= TELNETSPY_SEVERITY_ERROR)) {
+				// The severity of the line which starts now
+				if (textLen == 0) {
+					level = c;
+				}
+				iacState = 0;
+				continue;
+			}
+			// Telnet commands (ping, compression offer) aren't log text
+			iacState = ((iacState == 1) && (c >= 251) && (c <= 254)) ? 2 : 0;
+			continue;
+		}
+		if (c == 255) {
+			iacState = 1;
+			continue;
+		}
+		if ((c == 0) || (c == '\r')) {
+			// NUL (ping) and CR of CR LF
+			continue;
+		}
+		if ((c == '\n') || (textLen >= textMax)) {
+			// Without a token for the datagram the rest stays in the
+			// transmit buffer
+			if (!sendLine()) {
+				break;
+			}
+			if (c == '\n') {
+				continue;
+			}
+		}
+		text[textLen++] = c;
+	}
+	return pos;
+}
+
+int TelnetSpySyslogTransport::available(uint8_t slot) {
+	return 0;
+}
+
+int TelnetSpySyslogTransport::read(uint8_t slot, uint8_t* data, size_t len) {
+	return 0;
+}
+
+int TelnetSpySyslogTransport::peek(uint8_t slot) {
+	return -1;
+}
+
+void TelnetSpySyslogTransport::flush(uint8_t slot) {
+	if (slot == openSlot) {
+		sendLine();
+	}
+}
+
+void TelnetSpySyslogTransport::stop(uint8_t slot) {
+	if (slot == openSlot) {
+		sendLine();
+		openSlot = 0xFF;
+		textLen = 0;
+	}
+}
+
+bool TelnetSpySyslogTransport::lineSeverities() {
+	return true;
+}
+
+// Stream compression for the telnet option COMPRESS2 (MCCP2): deflate (RFC
+// 1951) with the fixed Huffman codes in a zlib wrapper. Every write ends with
+// a sync flush, so the client can inflate all data sent so far.
+
+// Start of the compressed stream: IAC SB COMPRESS2 IAC SE and the zlib header
+static const uint8_t TelnetSpy_deflateStart[] = { 255, 250, 86, 255, 240, 0x78, 0x01 };
+
+// Output of one chunk: the start of the stream, up to 9 / 8 of the data, the
+// flush and the bits of the last chunk
+static const uint16_t TelnetSpy_deflateOutLen = sizeof(TelnetSpy_deflateStart) + TELNETSPY_COMPRESSION_CHUNK
+		+ (TELNETSPY_COMPRESSION_CHUNK >> 3) + 16;
+
+struct TelnetSpyDeflate {
+	uint8_t window[TELNETSPY_COMPRESSION_WINDOW];	// the last sent bytes
+	uint16_t head[1 << TELNETSPY_COMPRESSION_HASH_BITS];	// stream positions of 3 byte sequences
+	uint32_t total;		// bytes compressed so far
+	uint32_t bits;		// output bits not yet written
+	uint32_t adler;		// Adler-32 of the uncompressed data (for the end of the stream)
+	uint8_t bitCount;
+	bool inBlock;
+	bool started;		// the start of the stream is sent
+	bool ending;		// the end of the stream is pending, uncompressed data follows
+	uint16_t pendingLen;
+	uint8_t pending[TelnetSpy_deflateOutLen + 10];	// output the transport didn't accept yet
+};
+
+static const uint16_t TelnetSpy_lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23,
+		27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t TelnetSpy_lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t TelnetSpy_distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
+		129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t TelnetSpy_distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static void TelnetSpy_putBits(TelnetSpyDeflate* z, uint32_t value, uint8_t len, uint8_t* out, uint16_t* n) {
+	// Extra bits and headers are written LSB first
+	z->bits |= value << z->bitCount;
+	z->bitCount += len;
+	while (z->bitCount >= 8) {
+		out[(*n)++] = z->bits & 0xFF;
+		z->bits >>= 8;
+		z->bitCount -= 8;
+	}
+}
+
+static void TelnetSpy_putCode(TelnetSpyDeflate* z, uint16_t code, uint8_t len, uint8_t* out, uint16_t* n) {
+	// Huffman codes are written MSB first
+	uint16_t rev = 0;
+	for (uint8_t i = 0; i < len; i++) {
+		rev = (rev << 1) | ((code >> i) & 1);
+	}
+	TelnetSpy_putBits(z, rev, len, out, n);
+}
+
+static uint8_t TelnetSpy_symbolBits(uint16_t sym) {
+	return (sym < 144) ? 8 : (sym < 256) ? 9 : (sym < 280) ? 7 : 8;
+}
+
+static void TelnetSpy_putSymbol(TelnetSpyDeflate* z, uint16_t sym, uint8_t* out, uint16_t* n) {
+	if (sym < 144) {
+		TelnetSpy_putCode(z, 0x30 + sym, 8, out, n);
+	} else if (sym < 256) {
+		TelnetSpy_putCode(z, 0x190 + sym - 144, 9, out, n);
+	} else if (sym < 280) {
+		TelnetSpy_putCode(z, sym - 256, 7, out, n);
+	} else {
+		TelnetSpy_putCode(z, 0xC0 + sym - 280, 8, out, n);
+	}
+}
+
+static uint16_t TelnetSpy_deflate(TelnetSpyDeflate* z, const uint8_t* in, uint16_t len, bool flush, uint8_t* out) {
+	// Compresses the data and returns the size of the output, out needs
+	// len * 9 / 8 + 8 bytes (the used code is never longer than the literals)
+	const uint16_t mask = TELNETSPY_COMPRESSION_WINDOW - 1;
+	uint16_t n = 0;
+	if (!z->inBlock) {
+		// Block header: not the last block, fixed Huffman codes
+		TelnetSpy_putBits(z, 2, 3, out, &n);
+		z->inBlock = true;
+	}
+	uint16_t i = 0;
+	while (i < len) {
+		uint16_t m = 0;
+		uint32_t dist = 0;
+		if (i + 3 <= len) {
+			uint32_t h = ((uint32_t) in[i] | (uint32_t) in[i + 1] << 8 | (uint32_t) in[i + 2] << 16) * 2654435761u;
+			h >>= 32 - TELNETSPY_COMPRESSION_HASH_BITS;
+			dist = (uint16_t) (z->total - z->head[h]);
+			z->head[h] = z->total;
+			if ((dist > 0) && (dist <= TELNETSPY_COMPRESSION_WINDOW) && (dist <= z->total)) {
+				uint16_t maxLen = min((uint16_t) (len - i), (uint16_t) 258);
+				uint32_t cand = z->total - dist;
+				while (m < maxLen) {
+					uint8_t c = (m < dist) ? z->window[(cand + m) & mask] : in[i + m - dist];
+					if (c != in[i + m]) {
+						break;
+					}
+					m++;
+				}
+			}
+		}
+		uint8_t lc = 0;
+		uint8_t dc = 0;
+		if (m >= 3) {
+			while ((lc < 28) && (TelnetSpy_lenBase[lc + 1] <= m)) {
+				lc++;
+			}
+			while ((dc < 29) && (TelnetSpy_distBase[dc + 1] <= dist)) {
+				dc++;
+			}
+			// Use the match only if it is shorter than the literals
+			uint16_t bits = TelnetSpy_symbolBits(257 + lc) + TelnetSpy_lenExtra[lc] + 5 + TelnetSpy_distExtra[dc];
+			uint16_t litBits = 0;
+			for (uint16_t k = 0; k < m; k++) {
+				litBits += TelnetSpy_symbolBits(in[i + k]);
+			}
+			if (bits >= litBits) {
+				m = 0;
+			}
+		}
+		if (m >= 3) {
+			TelnetSpy_putSymbol(z, 257 + lc, out, &n);
+			TelnetSpy_putBits(z, m - TelnetSpy_lenBase[lc], TelnetSpy_lenExtra[lc], out, &n);
+			TelnetSpy_putCode(z, dc, 5, out, &n);
+			TelnetSpy_putBits(z, dist - TelnetSpy_distBase[dc], TelnetSpy_distExtra[dc], out, &n);
+		} else {
+			m = 1;
+			TelnetSpy_putSymbol(z, in[i], out, &n);
+		}
+		for (uint16_t k = 0; k < m; k++) {
+			z->window[z->total++ & mask] = in[i++];
+		}
+	}
+	// The sums cannot overflow for TELNETSPY_COMPRESSION_CHUNK bytes
+	uint32_t s1 = z->adler & 0xFFFF;
+	uint32_t s2 = z->adler >> 16;
+	for (i = 0; i < len; i++) {
+		s1 += in[i];
+		s2 += s1;
+	}
+	z->adler = ((s2 % 65521) << 16) | (s1 % 65521);
+	if (flush) {
+		// End of block, followed by an empty stored block (sync flush)
+		TelnetSpy_putSymbol(z, 256, out, &n);
+		TelnetSpy_putBits(z, 0, 3, out, &n);
+		if (z->bitCount > 0) {
+			TelnetSpy_putBits(z, 0, 8 - z->bitCount, out, &n);
+		}
+		out[n++] = 0x00;
+		out[n++] = 0x00;
+		out[n++] = 0xFF;
+		out[n++] = 0xFF;
+		z->inBlock = false;
+	}
+	return n;
+}
+
+static uint16_t TelnetSpy_deflateEnd(TelnetSpyDeflate* z, uint8_t* out) {
+	// Ends the stream with an empty last block and the Adler-32 of the data,
+	// out needs 10 bytes
+	uint16_t n = 0;
+	if (z->inBlock) {
+		TelnetSpy_putSymbol(z, 256, out, &n);
+	}
+	// Block header: last block, fixed Huffman codes
+	TelnetSpy_putBits(z, 3, 3, out, &n);
+	TelnetSpy_putSymbol(z, 256, out, &n);
+	if (z->bitCount > 0) {
+		TelnetSpy_putBits(z, 0, 8 - z->bitCount, out, &n);
+	}
+	for (int8_t shift = 24; shift >= 0; shift -= 8) {
+		out[n++] = (z->adler >> shift) & 0xFF;
+	}
+	return n;
+}
+
+TelnetSpy::TelnetSpy(char* buffer, size_t size, char* recBuffer, size_t recSize) {
+	port = TELNETSPY_PORT;
+	transport = &wifiTransport;
+#ifndef ESP8266
+	task = NULL;
+	taskMutex = NULL;
+	taskStop = false;
+#endif
+	started = false;
+	listening = false;
+	firstMainLoop = true;
+	usedSer = &Serial;
+	storeOffline = true;
+	maxClients = TELNETSPY_CLIENTS;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		connected[i] = false;
+		clientSent[i] = 0;
+		clientDropped[i] = 0;
+		clientStamp[i] = 0;
+		clientStampPos[i] = 0;
+		clientLive[i] = 0;
+		clientReplay[i] = false;
+		clientReplayMid[i] = false;
+		clientReplayLeft[i] = 0;
+		clientLiveSent[i] = 0;
+		clientLiveStamp[i] = 0;
+		clientLiveStampPos[i] = 0;
+		clientLiveMid[i] = false;
+		clientBacklog[i] = 0;
+		clientBacklogPos[i] = 0;
+		nvtState[i] = TELNETSPY_NVT_DATA;
+		deflate[i] = NULL;
+	}
+	replayMode = TELNETSPY_REPLAY;
+	replayValue = 0;
+	replayBudget = TELNETSPY_REPLAY_BUDGET;
+	compression = TELNETSPY_COMPRESSION;
+	callbackConnect = NULL;
+	callbackDisconnect = NULL;
+    callbackNvtBRK = NULL;
+    callbackNvtIP = (void(*)()) 1;  // 1 => use ESP.restart;
+    callbackNvtAO = (void(*)()) 1;  // 1 => use TelnetSpy.disconnectClient()
+    callbackNvtAYT = NULL;
+    callbackNvtEC = NULL;
+    callbackNvtEL = NULL;
+    callbackNvtGA = NULL;
+    callbackNvtWWDD = NULL;
+	welcomeMsg = PSTR(TELNETSPY_WELCOME_MSG);
+	welcomeMsgFlash = true;
+	rejectMsg = PSTR(TELNETSPY_REJECT_MSG);
+	rejectMsgFlash = true;
+    filterChar = 0;
+    filterMsg = NULL;
+    filterMsgFlash = false;
+    filterCallback = NULL;
+	minBlockSize = TELNETSPY_MIN_BLOCK_SIZE;
+	collectingTime = TELNETSPY_COLLECTING_TIME;
+	maxBlockSize = TELNETSPY_MAX_BLOCK_SIZE;
+	pingTime = TELNETSPY_PING_TIME;
+	pingRef = 0xFFFFFFFF;
+	waitRef = 0xFFFFFFFF;
+    nvtDetected = false;
+	memset(&stats, 0, sizeof(stats));
+	timestamps = false;
+	severities = false;
+	severityMarks = false;
+	records = false;
+	lineStart = true;
+	skipLine = false;
+	severity = TELNETSPY_WRITE_SEVERITY;
+	severityThreshold = TELNETSPY_SEVERITY_THRESHOLD;
+	setOverflowPolicy(TELNETSPY_OVERFLOW);
+	lastStamp = 0;
+	bufStamp = 0;
+	bufChanges = 0;
+	renderBuf = NULL;
+	telnetBuf = NULL;
+	bufLen = 0;
+	externalRam = TELNETSPY_EXTERNAL_RAM;
+	bufRegion = NULL;
+	bufRegionLen = 0;
+	if (buffer) {
+		setBuffer(buffer, size);
+	} else {
+		size = TELNETSPY_BUFFER_LEN;
+		while (!setBufferSize(size)) {
+			size = size >> 1;
+			if (size < minBlockSize) {
+				setBufferSize(minBlockSize);
+				break;
+			}
+		}
+	}
+	recBuf = NULL;
+	recLen = 0;
+	recRegion = NULL;
+	recRegionLen = 0;
+	if (recBuffer) {
+		setRecBuffer(recBuffer, recSize);
+	} else {
+		setRecBufferSize(TELNETSPY_REC_BUFFER_LEN);
+	}
+	serBuf = NULL;
+	serLen = 0;
+	serUsed = 0;
+	serRdIdx = 0;
+	serWrIdx = 0;
+	setSerialQueueSize(TELNETSPY_SERIAL_QUEUE_LEN);
+	backlogBuf = NULL;
+	backlogTmp = NULL;
+	backlogLen = 0;
+	backlogStart = 0;
+	backlogUsed = 0;
+	backlogBusy = false;
+	handling = false;
+	setBacklogSize(TELNETSPY_BACKLOG_LEN);
+	storage = NULL;
+	saveTime = TELNETSPY_SAVE_TIME;
+	saveRef = 0;
+	saveDirty = false;
+	debugOutput = TELNETSPY_CAPTURE_OS_PRINT;
+	if (debugOutput) {
+		setDebugOutput(true);
+	}
+}
+
+TelnetSpy::~TelnetSpy() {
+#ifndef ESP8266
+	stopTask();
+#endif
+	end();
+	TelnetSpy_setMsg(&welcomeMsg, &welcomeMsgFlash, NULL, false);
+	TelnetSpy_setMsg(&rejectMsg, &rejectMsgFlash, NULL, false);
+	TelnetSpy_setMsg(&filterMsg, &filterMsgFlash, NULL, false);
+	if (telnetBuf && !bufRegion) free(telnetBuf);
+	if (recBuf && !recRegion) free(recBuf);
+	if (serBuf) free(serBuf);
+	if (renderBuf) free(renderBuf);
+	if (backlogBuf) free(backlogBuf);
+	if (backlogTmp) free(backlogTmp);
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		endCompression(i);
+	}
+#ifndef ESP8266
+	if (taskMutex) vSemaphoreDelete(taskMutex);
+#endif
+}
+
+void TelnetSpy::setPort(uint16_t portToUse) {
+	lockClients();
+	port = portToUse;
+	if (listening) {
+		// The next handle() listens on the new port
+		disconnectClient();
+		transport->end();
+		listening = false;
+	}
+	unlockClients();
+}
+
+void TelnetSpy::setWelcomeMsg(const char* msg) {
+	TelnetSpy_setMsg(&welcomeMsg, &welcomeMsgFlash, msg, false);
+}
+
+void TelnetSpy::setWelcomeMsg(const String& msg) {
+	TelnetSpy_setMsg(&welcomeMsg, &welcomeMsgFlash, msg.c_str(), false);
+}
+
+void TelnetSpy::setWelcomeMsg(const __FlashStringHelper* msg) {
+	TelnetSpy_setMsg(&welcomeMsg, &welcomeMsgFlash, (const char*) msg, true);
+}
+
+void TelnetSpy::setRejectMsg(const char* msg) {
+	TelnetSpy_setMsg(&rejectMsg, &rejectMsgFlash, msg, false);
+}
+
+void TelnetSpy::setRejectMsg(const String& msg) {
+	TelnetSpy_setMsg(&rejectMsg, &rejectMsgFlash, msg.c_str(), false);
+}
+
+void TelnetSpy::setRejectMsg(const __FlashStringHelper* msg) {
+	TelnetSpy_setMsg(&rejectMsg, &rejectMsgFlash, (const char*) msg, true);
+}
+
+void TelnetSpy::setMinBlockSize(uint16_t minSize) {
+	minBlockSize = min(max((uint16_t) 1, minSize), maxBlockSize);
+}
+    
+void TelnetSpy::setCollectingTime(uint16_t colTime) {
+	collectingTime = colTime;
+}
+
+void TelnetSpy::setMaxBlockSize(uint16_t maxSize) {
+	maxSize = max(maxSize, minBlockSize);
+	if (renderBuf) {
+		char* temp = (char*) realloc(renderBuf, maxSize);
+		if (!temp) {
+			return;
+		}
+		renderBuf = temp;
+	}
+	maxBlockSize = maxSize;
+}
+
+bool TelnetSpy::setBufferSize(size_t newSize) {
+	if (telnetBuf && (bufLen == newSize)) {
+		return true;
+	}
+	if (newSize == 0) {
+		lockClients();
+		char* temp = telnetBuf;
+CRITCAL_SECTION_START
+		telnetBuf = NULL;
+		bufLen = 0;
+CRITCAL_SECTION_END
+		// The buffered data is gone, so are the positions of the clients in it
+		clearBuffer();
+		if (temp && !bufRegion) {
+			free(temp);
+		}
+		unlockClients();
+		transport->setNoDelay(false);
+		return true;
+	}
+	newSize = max(newSize, (size_t) minBlockSize);
+	if (bufRegion && (newSize > bufRegionLen)) {
+		// The memory given by setBuffer cannot grow
+		return false;
+	}
+	char* temp = telnetBuf;
+	if (!temp) {
+		temp = bufRegion ? bufRegion : (char*) TelnetSpy_realloc(NULL, newSize, externalRam);
+		bufUsed = 0;
+	} else if (!bufRegion && (newSize > bufLen)) {
+		temp = (char*) TelnetSpy_realloc(telnetBuf, newSize, externalRam);
+	}
+	if (!temp) {
+		return false;
+	}
+	telnetBuf = temp;
+	// The youngest data is moved to the start of the buffer, so the resizing
+	// works in place
+	packTelnetBuf(newSize);
+	if (!bufRegion && (newSize < bufLen)) {
+		temp = (char*) TelnetSpy_realloc(telnetBuf, newSize, externalRam);
+		if (temp) {
+			telnetBuf = temp;
+		}
+	}
+	bufLen = newSize;
+	bufWrIdx = (bufUsed < bufLen) ? (size_t) bufUsed : 0;
+	transport->setNoDelay(true);
+	return true;
+}
+
+bool TelnetSpy::setBuffer(char* buffer, size_t size) {
+	if (!buffer && !bufRegion) {
+		return setBufferSize(size);
+	}
+	if (buffer && (size < minBlockSize)) {
+		return false;
+	}
+	if (!buffer && (size == 0)) {
+		setBufferSize(0);
+		bufRegion = NULL;
+		bufRegionLen = 0;
+		return true;
+	}
+	size = max(size, (size_t) minBlockSize);
+	char* temp = buffer ? buffer : (char*) TelnetSpy_realloc(NULL, size, externalRam);
+	if (!temp) {
+		return false;
+	}
+	if (telnetBuf) {
+		packTelnetBuf(size);
+		memmove(temp, telnetBuf, bufUsed);
+		if (!bufRegion) {
+			free(telnetBuf);
+		}
+	} else {
+		bufUsed = 0;
+		bufRdIdx = 0;
+	}
+	telnetBuf = temp;
+	bufRegion = buffer;
+	bufRegionLen = buffer ? size : 0;
+	bufLen = size;
+	bufWrIdx = (bufUsed < bufLen) ? (size_t) bufUsed : 0;
+	transport->setNoDelay(true);
+	return true;
+}
+
+size_t TelnetSpy::getBufferSize() {
+	if (!telnetBuf) {
+		return 0;
+	}
+	return bufLen;
+}
+
+void TelnetSpy::setExternalRam(bool external) {
+	externalRam = external;
+	// Move the existing buffers, they stay where they are if this fails
+	if (telnetBuf && !bufRegion) {
+		char* temp = (char*) TelnetSpy_realloc(telnetBuf, bufLen, externalRam);
+		if (temp) {
+			telnetBuf = temp;
+		}
+	}
+	if (backlogBuf) {
+		uint8_t* temp = (uint8_t*) TelnetSpy_realloc(backlogBuf, backlogLen, externalRam);
+		if (temp) {
+			backlogBuf = temp;
+		}
+	}
+}
+
+bool TelnetSpy::getExternalRam() {
+	return externalRam;
+}
+
+void TelnetSpy::setStoreOffline(bool store) {
+	storeOffline = store;
+}
+
+bool TelnetSpy::getStoreOffline() {
+	return storeOffline;
+}
+
+void TelnetSpy::setPingTime(uint16_t pngTime) {
+	pingTime = pngTime;
+	if (pingTime == 0) {
+		pingRef = 0xFFFFFFFF;
+	} else {
+		pingRef = (millis() & 0x7FFFFFF) + pingTime;
+	}
+}
+
+bool TelnetSpy::setRecBufferSize(size_t newSize) {
+	if (recBuf && (recLen == newSize)) {
+		return true;
+	}
+	if (recRegion && (newSize > recRegionLen)) {
+		// The memory given by setRecBuffer cannot grow
+		return false;
+	}
+	if (recBuf) {
+		if (!recRegion) {
+			free(recBuf);
+		}
+		recBuf = NULL;
+        recLen = 0;
+	}
+	if (newSize == 0) {
+		return true;
+	}
+	recBuf = recRegion ? recRegion : (char*) malloc(newSize);
+	if (!recBuf) {
+		return false;
+    }
+    recLen = newSize;
+	recRdIdx = 0;
+	recWrIdx = 0;
+	recUsed = 0;
+	return true;
+}
+
+size_t TelnetSpy::getRecBufferSize() {
+	if (!recBuf) {
+		return 0;
+	}
+	return recLen;
+}
+
+bool TelnetSpy::setRecBuffer(char* buffer, size_t size) {
+	if (recBuf && !recRegion) {
+		free(recBuf);
+	}
+	recBuf = NULL;
+	recLen = 0;
+	recRegion = buffer;
+	recRegionLen = buffer ? size : 0;
+	return setRecBufferSize(size);
+}
+
+bool TelnetSpy::setBacklogSize(uint16_t newSize) {
+	if (backlogBuf && (backlogLen == newSize)) {
+		return true;
+	}
+CRITCAL_SECTION_START
+	uint8_t* oldBuf = backlogBuf;
+	uint8_t* oldTmp = backlogTmp;
+	backlogBuf = NULL;
+	backlogTmp = NULL;
+	backlogLen = 0;
+	backlogStart = 0;
+	backlogUsed = 0;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clientBacklog[i] = 0;
+		clientBacklogPos[i] = 0;
+	}
+CRITCAL_SECTION_END
+	if (oldBuf) {
+		free(oldBuf);
+		free(oldTmp);
+	}
+	if (newSize == 0) {
+		return true;
+	}
+	// The scratch buffer takes the text of a block and the hash table to pack
+	// it, followed by the text of a block to send (see sendBlock)
+	uint8_t* buf = (uint8_t*) TelnetSpy_realloc(NULL, newSize, externalRam);
+	uint8_t* tmp = (uint8_t*) malloc(2 * TELNETSPY_BACKLOG_BLOCK_LEN + (sizeof(uint16_t) << TELNETSPY_BACKLOG_HASH_BITS));
+	if (!buf || !tmp) {
+		if (buf) free(buf);
+		if (tmp) free(tmp);
+		return false;
+	}
+CRITCAL_SECTION_START
+	backlogBuf = buf;
+	backlogTmp = tmp;
+	backlogLen = newSize;
+CRITCAL_SECTION_END
+	return true;
+}
+
+uint16_t TelnetSpy::getBacklogSize() {
+	if (!backlogBuf) {
+		return 0;
+	}
+	return backlogLen;
+}
+
+bool TelnetSpy::setStorage(TelnetSpyStorage* newStorage) {
+	storage = newStorage;
+	saveDirty = false;
+	saveRef = millis();
+	if (!storage || !telnetBuf) {
+		return false;
+	}
+	if (!restoreBuffer()) {
+		return false;
+	}
+	// Save the restored data again, a new crash may happen before the next write
+	saveDirty = true;
+	return true;
+}
+
+void TelnetSpy::setSaveTime(uint16_t time) {
+	saveTime = time;
+}
+
+bool TelnetSpy::saveBuffer() {
+	if (!storage || !telnetBuf) {
+		return false;
+	}
+	uint16_t space = storage->size();
+	if (space <= TELNETSPY_STORAGE_HEADER_LEN) {
+		return false;
+	}
+	space -= TELNETSPY_STORAGE_HEADER_LEN;
+	saveDirty = false;
+	for (uint8_t tries = 0; tries < TELNETSPY_SAVE_TRIES; tries++) {
+CRITCAL_SECTION_START
+		uint32_t changes = bufChanges;
+		size_t len = bufUsed;
+		size_t pos = 0;
+		if (len > space) {
+			// Save complete lines only
+			pos = len - space;
+			size_t idx = bufRdIdx + pos - 1;
+			if (idx >= bufLen) {
+				idx -= bufLen;
+			}
+			while ((pos < len) && (telnetBuf[idx] != '\n')) {
+				pos++;
+				if (++idx >= bufLen) {
+					idx = 0;
+				}
+			}
+		}
+		unsigned long stamp = timestamps ? skipRecords(bufRdIdx, pos, bufStamp) : 0;
+		size_t start = bufRdIdx + pos;
+		if (start >= bufLen) {
+			start -= bufLen;
+		}
+		len -= pos;
+CRITCAL_SECTION_END
+		// The data is written in front of the header, so an interrupted save
+		// leaves a wrong checksum
+		uint32_t sum = 2166136261UL;
+		uint8_t chunk[64];
+		bool valid = true;
+		for (pos = 0; pos < len; pos += sizeof(chunk)) {
+			uint16_t n = min(len - pos, sizeof(chunk));
+			size_t idx = start + pos;
+			if (idx >= bufLen) {
+				idx -= bufLen;
+			}
+CRITCAL_SECTION_START
+			uint16_t tmp = min((size_t) n, bufLen - idx);
+			memcpy(chunk, &telnetBuf[idx], tmp);
+			memcpy(&chunk[tmp], telnetBuf, n - tmp);
+			valid = (bufChanges == changes);
+CRITCAL_SECTION_END
+			if (!valid) {
+				// Data was dropped or moved meanwhile, so the copy would mix
+				// old and new data
+				break;
+			}
+			sum = TelnetSpy_checksum(sum, chunk, n);
+			if (!storage->write(TELNETSPY_STORAGE_HEADER_LEN + pos, chunk, n)) {
+				return false;
+			}
+		}
+		if (!valid) {
+			continue;
+		}
+		// Header: magic value, size of the data, format, time at the start of
+		// the data and checksum of the data and the header (all LSB first)
+		uint8_t hdr[TELNETSPY_STORAGE_HEADER_LEN];
+		uint32_t magic = TELNETSPY_STORAGE_MAGIC;
+		for (uint8_t i = 0; i < 4; i++) {
+			hdr[i] = (magic >> (8 * i)) & 0xFF;
+			hdr[8 + i] = (stamp >> (8 * i)) & 0xFF;
+		}
+		hdr[4] = len & 0xFF;
+		hdr[5] = len >> 8;
+		hdr[6] = (records ? 1 : 0) | (timestamps ? 2 : 0);
+		hdr[7] = 0;
+		sum = TelnetSpy_checksum(sum, hdr, 12);
+		for (uint8_t i = 0; i < 4; i++) {
+			hdr[12 + i] = (sum >> (8 * i)) & 0xFF;
+		}
+		return storage->write(0, hdr, sizeof(hdr));
+	}
+	// The buffer was changed during every try, save it again later
+	saveDirty = true;
+	return false;
+}
+
+bool TelnetSpy::restoreBuffer() {
+	// Puts the valid data of the storage in front of the transmit buffer
+	uint8_t hdr[TELNETSPY_STORAGE_HEADER_LEN];
+	if (!storage->read(0, hdr, sizeof(hdr))) {
+		return false;
+	}
+	uint32_t magic = 0;
+	uint32_t stamp = 0;
+	uint32_t sum = 0;
+	for (uint8_t i = 0; i < 4; i++) {
+		magic |= (uint32_t) hdr[i] << (8 * i);
+		stamp |= (uint32_t) hdr[8 + i] << (8 * i);
+		sum |= (uint32_t) hdr[12 + i] << (8 * i);
+	}
+	uint16_t len = hdr[4] | (hdr[5] << 8);
+	if ((magic != TELNETSPY_STORAGE_MAGIC) || (len == 0)
+			|| (len > storage->size() - TELNETSPY_STORAGE_HEADER_LEN)) {
+		return false;
+	}
+	uint8_t* data = (uint8_t*) malloc(len);
+	if (!data) {
+		return false;
+	}
+	if (!storage->read(TELNETSPY_STORAGE_HEADER_LEN, data, len)
+			|| (TelnetSpy_checksum(TelnetSpy_checksum(2166136261UL, data, len), hdr, 12) != sum)) {
+		free(data);
+		return false;
+	}
+	char* text = (char*) data;
+	size_t textLen = len;
+	if (hdr[6] & 1) {
+		// Render the records with the settings of the last run
+		bool useTimestamps = timestamps;
+		timestamps = hdr[6] & 2;
+		unsigned long t = stamp;
+		uint8_t skip = 0;
+		size_t raw;
+		textLen = renderRecords((char*) data, len, 0, len, &t, &skip, NULL, SIZE_MAX, &raw);
+		text = (char*) malloc(textLen);
+		if (text) {
+			t = stamp;
+			renderRecords((char*) data, len, 0, len, &t, &skip, text, textLen, &raw);
+		}
+		timestamps = useTimestamps;
+		free(data);
+		if (!text) {
+			return false;
+		}
+	}
+	bool ok = prependTelnetBuf(text, textLen);
+	free(text);
+	return ok;
+}
+
+bool TelnetSpy::prependTelnetBuf(const char* text, size_t len) {
+	// Puts the text (followed by TELNETSPY_RESTART_MSG) in front of the
+	// buffered data without record headers, so it is sent as it is. The
+	// oldest lines of the text are dropped if it doesn't fit, the oldest
+	// lines of the buffer are dropped if even the message doesn't fit.
+	// Returns false if the buffer is too small for the message.
+	const char* msg = TELNETSPY_RESTART_MSG;
+	uint16_t msgLen = strlen(msg);
+	// Terminate a line which was incomplete on the restart
+	bool newLine = (len > 0) && (text[len - 1] != '\n');
+	if (newLine) {
+		msgLen += 2;
+	}
+	if (msgLen > bufLen) {
+		return false;
+	}
+	while (bufLen - bufUsed < msgLen) {
+		evictTelnetLine(TELNETSPY_SEVERITY_ERROR);
+	}
+CRITCAL_SECTION_START
+	size_t space = bufLen - bufUsed;
+	if (msgLen > space) {
+		// Filled again by an interrupt
+CRITCAL_SECTION_END
+		return false;
+	}
+	size_t size = msgLen;
+	size_t pos = len;
+	while (pos > 0) {
+		uint16_t n = (records && (text[pos - 1] == TELNETSPY_RECORD_MARK)) ? 2 : 1;
+		if (size + n > space) {
+			break;
+		}
+		size += n;
+		pos--;
+	}
+	while ((pos > 0) && (pos < len) && (text[pos - 1] != '\n')) {
+		size -= (records && (text[pos] == TELNETSPY_RECORD_MARK)) ? 2 : 1;
+		pos++;
+	}
+	if (pos == len) {
+		newLine = false;
+		size = strlen(msg);
+	}
+	// Write backwards in front of the read index
+	size_t idx = bufRdIdx;
+	for (uint16_t i = strlen(msg); i > 0; i--) {
+		idx = (idx == 0) ? bufLen - 1 : idx - 1;
+		telnetBuf[idx] = msg[i - 1];
+	}
+	if (newLine) {
+		idx = (idx == 0) ? bufLen - 1 : idx - 1;
+		telnetBuf[idx] = '\n';
+		idx = (idx == 0) ? bufLen - 1 : idx - 1;
+		telnetBuf[idx] = '\r';
+	}
+	for (size_t i = len; i > pos; i--) {
+		char c = text[i - 1];
+		if (records && (c == TELNETSPY_RECORD_MARK)) {
+			// A mark in the data is stored as mark + 0
+			idx = (idx == 0) ? bufLen - 1 : idx - 1;
+			telnetBuf[idx] = 0;
+		}
+		idx = (idx == 0) ? bufLen - 1 : idx - 1;
+		telnetBuf[idx] = c;
+	}
+	bufRdIdx = idx;
+	bufUsed += size;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (connected[i]) {
+			clientSent[i] += size;
+			clientLive[i] += size;
+			clientLiveSent[i] += size;
+		}
+	}
+	bufChanges++;
+	if (bufUsed > stats.peakBufUsed) {
+		stats.peakBufUsed = bufUsed;
+	}
+CRITCAL_SECTION_END
+	return true;
+}
+
+void TelnetSpy::setTransport(TelnetSpyTransport* newTransport) {
+	lockClients();
+	if (listening) {
+		// The next handle() starts the new transport
+		disconnectClient();
+		transport->end();
+		listening = false;
+	}
+#ifndef ESP8266
+	if (task) {
+		transport->setWakeup(NULL, NULL);
+		(newTransport ? newTransport : &wifiTransport)->setWakeup(wakeupTask, this);
+	}
+#endif
+	transport = newTransport ? newTransport : &wifiTransport;
+	if (transport->lineSeverities() != severityMarks) {
+		// The severity must be stored with every line
+		severityMarks = !severityMarks;
+		setRecords(timestamps, severities);
+	}
+	unlockClients();
+}
+
+void TelnetSpy::setReplay(uint8_t mode, uint32_t value) {
+	replayMode = mode;
+	replayValue = value;
+}
+
+uint8_t TelnetSpy::getReplay() {
+	return replayMode;
+}
+
+void TelnetSpy::setReplayBudget(uint16_t bytes) {
+	replayBudget = bytes;
+}
+
+uint16_t TelnetSpy::getReplayBudget() {
+	return replayBudget;
+}
+
+size_t TelnetSpy::replayStart() {
+	// Returns the position of the first byte of the transmit buffer which is
+	// replayed to a new client, must be called inside of the critical section
+	switch (replayMode) {
+		case TELNETSPY_REPLAY_NONE:
+			return bufUsed;
+		case TELNETSPY_REPLAY_LINES: {
+			if ((replayValue == 0) || (bufUsed == 0)) {
+				return bufUsed;
+			}
+			// Count the line feeds backwards (the last byte ends the last line)
+			uint32_t lines = 0;
+			size_t idx = bufRdIdx + bufUsed - 1;
+			if (idx >= bufLen) {
+				idx -= bufLen;
+			}
+			for (size_t off = bufUsed - 1; off > 0; off--) {
+				idx = (idx == 0) ? bufLen - 1 : idx - 1;
+				if ((telnetBuf[idx] == '\n') && (++lines == replayValue)) {
+					return off;
+				}
+			}
+			return 0;
+		}
+		case TELNETSPY_REPLAY_SINCE: {
+			if (!timestamps) {
+				return 0;
+			}
+			// Search the first record header with a younger time
+			unsigned long stamp = bufStamp;
+			size_t off = 0;
+			while (off < bufUsed) {
+				size_t idx = bufRdIdx + off;
+				if (idx >= bufLen) {
+					idx -= bufLen;
+				}
+				size_t tmp = min((size_t) bufUsed - off, bufLen - idx);
+				char* p = (char*) memchr(&telnetBuf[idx], TELNETSPY_RECORD_MARK, tmp);
+				if (!p) {
+					off += tmp;
+					continue;
+				}
+				off += p - &telnetBuf[idx];
+				uint32_t value;
+				uint8_t level;
+				uint8_t n = recordAt(telnetBuf, bufLen, p - telnetBuf, &value, &level);
+				if (value > 0) {
+					stamp += value - 1;
+					if ((long) (stamp - replayValue) >= 0) {
+						return off;
+					}
+				}
+				off += n;
+			}
+			return bufUsed;
+		}
+		default:
+			return 0;
+	}
+}
+
+void TelnetSpy::setCompression(bool enable) {
+	compression = enable;
+}
+
+bool TelnetSpy::getCompression() {
+	return compression;
+}
+
+void TelnetSpy::endCompression(uint8_t slot, bool finish) {
+	TelnetSpyDeflate* z = deflate[slot];
+	if (!z || (finish && z->ending)) {
+		return;
+	}
+	if (finish && z->started) {
+		// The client continues with uncompressed data after the end of the
+		// stream, so the stream is kept until its end is sent
+		z->pendingLen += TelnetSpy_deflateEnd(z, &z->pending[z->pendingLen]);
+		z->ending = true;
+		flushCompression(slot);
+		return;
+	}
+	deflate[slot] = NULL;
+	free(z);
+}
+
+void TelnetSpy::resetClient(uint8_t slot) {
+	// Called on disconnect, so a stale cursor of the slot doesn't affect the
+	// buffer management (the dropped count stays readable up to the next connect)
+CRITCAL_SECTION_START
+	clientSent[slot] = 0;
+	clientStamp[slot] = bufStamp;
+	clientStampPos[slot] = 0;
+	clientLive[slot] = 0;
+	clientReplay[slot] = false;
+	clientReplayMid[slot] = false;
+	clientLiveSent[slot] = 0;
+	clientLiveStamp[slot] = bufStamp;
+	clientLiveStampPos[slot] = 0;
+	clientLiveMid[slot] = false;
+	clientBacklog[slot] = 0;
+	clientBacklogPos[slot] = 0;
+CRITCAL_SECTION_END
+	nvtState[slot] = TELNETSPY_NVT_DATA;
+	endCompression(slot);
+}
+
+bool TelnetSpy::flushCompression(uint8_t slot) {
+	// Sends the compressed output which didn't fit into the last write, returns
+	// true if nothing is left
+	TelnetSpyDeflate* z = deflate[slot];
+	if (!z || ((z->pendingLen == 0) && !z->ending)) {
+		return true;
+	}
+	uint16_t n = transport->write(slot, z->pending, z->pendingLen);
+	z->pendingLen -= n;
+	memmove(z->pending, &z->pending[n], z->pendingLen);
+	if (z->pendingLen > 0) {
+		return false;
+	}
+	if (z->ending) {
+		deflate[slot] = NULL;
+		free(z);
+	}
+	return true;
+}
+
+uint16_t TelnetSpy::writeClient(uint8_t slot, const uint8_t* data, uint16_t len) {
+	// Writes the data to the client (compressed if negotiated), returns the
+	// number of accepted bytes
+	// The stream must stay complete, so the rest of the last write goes first
+	if ((slot < TELNETSPY_MAX_CLIENTS) && !flushCompression(slot)) {
+		return 0;
+	}
+	TelnetSpyDeflate* z = (slot < TELNETSPY_MAX_CLIENTS) ? deflate[slot] : NULL;
+	if (!z) {
+		return transport->write(slot, data, len);
+	}
+	// Take only as much as surely fits (up to 9 / 8 of the data, the flush
+	// and the start of the stream), if the transport reports its free space
+	int avail = transport->availableForWrite(slot);
+	if (avail >= 0) {
+		avail -= 9 + (z->started ? 0 : sizeof(TelnetSpy_deflateStart));
+		len = (avail > 0) ? min(len, (uint16_t) min(avail * 4 / 5, 0xFFFF)) : 0;
+	}
+	if (len == 0) {
+		return 0;
+	}
+	uint8_t out[TelnetSpy_deflateOutLen];
+	for (uint16_t pos = 0; pos < len; pos += TELNETSPY_COMPRESSION_CHUNK) {
+		uint16_t n = min((uint16_t) (len - pos), (uint16_t) TELNETSPY_COMPRESSION_CHUNK);
+		uint16_t size = 0;
+		if (!z->started) {
+			// The stream starts in front of its first data
+			memcpy(out, TelnetSpy_deflateStart, sizeof(TelnetSpy_deflateStart));
+			size = sizeof(TelnetSpy_deflateStart);
+			z->started = true;
+		}
+		size += TelnetSpy_deflate(z, &data[pos], n, pos + n >= len, &out[size]);
+		uint16_t sent = transport->write(slot, out, size);
+		if (sent != size) {
+			// The data is compressed already, so its output is kept and sent
+			// before the next data (flushed, so the client gets all of it)
+			if (pos + n < len) {
+				size += TelnetSpy_deflate(z, NULL, 0, true, &out[size]);
+			}
+			memcpy(z->pending, &out[sent], size - sent);
+			z->pendingLen = size - sent;
+		}
+		stats.bytesDeflated += n;
+		stats.deflatedSize += size;
+		if (sent != size) {
+			return pos + n;
+		}
+	}
+	return len;
+}
+
+void TelnetSpy::writeMsg(uint8_t slot, const char* msg, bool flash) {
+	// A message in flash is copied in pieces, so it needs no RAM of its size
+	if (!msg) {
+		return;
+	}
+	if (!flash) {
+		uint16_t len = strlen(msg);
+		if (len > 0) {
+			writeClient(slot, (const uint8_t*) msg, len);
+		}
+		return;
+	}
+	char buf[32];
+	uint16_t len = strlen_P(msg);
+	for (uint16_t pos = 0; pos < len; pos += sizeof(buf)) {
+		uint16_t n = min((uint16_t) (len - pos), (uint16_t) sizeof(buf));
+		memcpy_P(buf, &msg[pos], n);
+		if (writeClient(slot, (const uint8_t*) buf, n) != n) {
+			return;
+		}
+	}
+}
+
+void TelnetSpy::setSerial(HardwareSerial* usedSerial) {
+	// The queued data belongs to the old serial port
+	sendSerialQueue(true);
+	usedSer = usedSerial;
+}
+
+bool TelnetSpy::setSerialQueueSize(uint16_t newSize) {
+	if (serBuf && (serLen == newSize)) {
+		return true;
+	}
+	sendSerialQueue(true);
+CRITCAL_SECTION_START
+	char* oldBuf = serBuf;
+	serBuf = NULL;
+	serLen = 0;
+	serUsed = 0;
+	serRdIdx = 0;
+	serWrIdx = 0;
+CRITCAL_SECTION_END
+	if (oldBuf) {
+		free(oldBuf);
+	}
+	if (newSize == 0) {
+		return true;
+	}
+	char* buf = (char*) malloc(newSize);
+	if (!buf) {
+		return false;
+	}
+CRITCAL_SECTION_START
+	serBuf = buf;
+	serLen = newSize;
+CRITCAL_SECTION_END
+	return true;
+}
+
+uint16_t TelnetSpy::getSerialQueueSize() {
+	if (!serBuf) {
+		return 0;
+	}
+	return serLen;
+}
+
+size_t TelnetSpy::writeSerial(const uint8_t* data, size_t len) {
+	if (!serBuf) {
+		return usedSer->write(data, len);
+	}
+	if (serUsed == 0) {
+		// Nothing queued: the UART takes what fits into its buffer directly
+		int avail = usedSer->availableForWrite();
+		if (avail > 0) {
+			size_t n = usedSer->write(data, min(len, (size_t) avail));
+			if (n >= len) {
+				return len;
+			}
+			data += n;
+			len -= n;
+		}
+	}
+CRITCAL_SECTION_START
+	size_t n = min(len, (size_t) (serLen - serUsed));
+	stats.serialDropped += len - n;
+	uint16_t tmp = min((uint16_t) n, (uint16_t) (serLen - serWrIdx));
+	memcpy(&serBuf[serWrIdx], data, tmp);
+	memcpy(serBuf, &data[tmp], n - tmp);
+	serWrIdx += n;
+	if (serWrIdx >= serLen) {
+		serWrIdx -= serLen;
+	}
+	serUsed += n;
+CRITCAL_SECTION_END
+	return len;
+}
+
+void TelnetSpy::sendSerialQueue(bool wait) {
+	// Sends the queued data (without waiting only what the UART takes now)
+	while (serBuf && (serUsed > 0)) {
+		uint16_t len = min((uint16_t) serUsed, (uint16_t) (serLen - serRdIdx));
+		if (!wait) {
+			int avail = usedSer ? usedSer->availableForWrite() : len;
+			if (avail <= 0) {
+				return;
+			}
+			if (avail < len) {
+				len = avail;
+			}
+		}
+		if (usedSer && *usedSer) {
+			len = usedSer->write((const uint8_t*) &serBuf[serRdIdx], len);
+			if (len == 0) {
+				return;
+			}
+		}
+CRITCAL_SECTION_START
+		serRdIdx += len;
+		if (serRdIdx >= serLen) {
+			serRdIdx = 0;
+		}
+		serUsed -= len;
+CRITCAL_SECTION_END
+	}
+}
+
+size_t TelnetSpy::write (uint8_t data) {
+	if (telnetBuf) {
+		storeTelnetBuf(&data, 1, true);
+	} else {
+		stats.bytesWritten++;
+		uint8_t mark[2] = { 255, severity };
+		// The transport gets the severity at the start of a line only
+		bool marked = severityMarks && lineStart;
+		lineStart = (data == '\n');
+		lockClients();
+		if (marked) {
+			writeClients(mark, 2);
+		}
+		writeClients(&data, 1);
+		unlockClients();
+	}
+	if ((NULL != usedSer) && *usedSer) {
+		return writeSerial(&data, 1);
+	}
+	return 1;
+}
+
+size_t TelnetSpy::write (const uint8_t* data, size_t len) {
+	if (len == 0) {
+		return 0;
+	}
+	if (telnetBuf) {
+		storeTelnetBuf(data, len, true);
+	} else {
+		stats.bytesWritten += len;
+		uint8_t mark[2] = { 255, severity };
+		// The severity is marked in front of the first line starting in the
+		// data, the following lines keep it
+		size_t markPos = len;
+		if (severityMarks && lineStart) {
+			markPos = 0;
+		} else if (severityMarks) {
+			const uint8_t* p = (const uint8_t*) memchr(data, '\n', len - 1);
+			if (p) {
+				markPos = p - data + 1;
+			}
+		}
+		lineStart = (data[len - 1] == '\n');
+		lockClients();
+		writeClients(data, markPos);
+		if (markPos < len) {
+			writeClients(mark, 2);
+		}
+		writeClients(&data[markPos], len - markPos);
+		unlockClients();
+	}
+	if ((NULL != usedSer) && *usedSer) {
+		return writeSerial(data, len);
+	}
+	return len;
+}
+
+void TelnetSpy::writeClients(const uint8_t* data, size_t len) {
+	// Without buffer, the data which doesn't fit is lost
+	for (uint8_t i = 0; (i < maxClients) && (len > 0); i++) {
+		for (size_t pos = 0; (pos < len) && transport->connected(i); ) {
+			uint16_t n = writeClient(i, &data[pos], min(len - pos, (size_t) 0xFFFF));
+			if (n == 0) {
+				break;
+			}
+			pos += n;
+		}
+	}
+}
+
+void TelnetSpy::debugWrite (uint8_t data) {
+	if (telnetBuf) {
+		storeTelnetBuf(&data, 1, false);
+	}
+#ifdef ESP8266
+    ets_putc(data);
+#else
+    ets_write_char_uart(data);
+#endif
+}
+
+void TelnetSpy::storeTelnetBuf(const uint8_t* data, size_t len, bool sendIfFull) {
+	if (overflowPolicy == TELNETSPY_OVERFLOW_SAMPLE) {
+		// The sampling decides for every line separately
+		const uint8_t* p;
+		while ((len > 1) && ((p = (const uint8_t*) memchr(data, '\n', len - 1)) != NULL)) {
+			size_t n = p - data + 1;
+			storeTelnetData(data, n, sendIfFull);
+			data += n;
+			len -= n;
+		}
+	}
+	storeTelnetData(data, len, sendIfFull);
+}
+
+void TelnetSpy::storeTelnetData(const uint8_t* data, size_t len, bool sendIfFull) {
+	stats.bytesWritten += len;
+	if ((severity < severityThreshold) || (!storeOffline && !clientsConnected())) {
+		stats.bytesDiscarded += len;
+		return;
+	}
+	if (skipLine) {
+		// The beginning of this line was not stored, so drop the rest of it too
+		const uint8_t* p = (const uint8_t*) memchr(data, '\n', len);
+		size_t n = p ? p - data + 1 : len;
+		stats.bytesDiscarded += n;
+		if (!p) {
+			return;
+		}
+		skipLine = false;
+		data += n;
+		len -= n;
+		if (len == 0) {
+			return;
+		}
+	}
+	size_t size = len;
+	unsigned long now = millis();
+	if (records) {
+		size = recordSize(data, len, now);
+		while (size > bufLen) {
+			// The line is too long for the buffer: store the youngest part only
+			data += size - bufLen;
+			len -= size - bufLen;
+			lineStart = true;
+			size = recordSize(data, len, now);
+		}
+	}
+#ifdef TELNETSPY_LOCK_FREE
+	if (size > (size_t) (bufLen - bufUsed)) {
+		stats.bytesDiscarded += len;
+		return;
+	}
+#else
+	if (size > (size_t) (bufLen - bufUsed)) {
+		if (sendIfFull && clientsConnected()) {
+			lockClients();
+			sendBlock();
+			unlockClients();
+			if ((overflowPolicy == TELNETSPY_OVERFLOW_BLOCK) && !overflowStalled && mayWaitTelnetBuf()
+					&& (size > (size_t) (bufLen - bufUsed))) {
+				waitTelnetBuf(size);
+			}
+		}
+		// A line which is already partially stored is always completed
+		uint8_t level = lineStart ? severity : TELNETSPY_SEVERITY_ERROR;
+		bool decide = lineStart;
+		bool compress = backlogBuf && !clientsConnected();
+		while ((bufUsed > 0) && (size > (size_t) (bufLen - bufUsed))) {
+			if (compress && compressTelnetBuf()) {
+				continue;
+			}
+			compress = false;
+			bool reject = decide && rejectLine();
+			decide = false;
+			if (reject || !evictTelnetLine(level)) {
+				// The policy or the more important buffered lines keep the old data
+				if (!reject) {
+					stats.linesRejected++;
+				}
+				stats.bytesDiscarded += len;
+				skipLine = (data[len - 1] != '\n');
+				return;
+			}
+		}
+	}
+#endif
+	saveDirty = true;
+#ifndef ESP8266
+	size_t used = bufUsed;
+#endif
+	if (records) {
+		addTelnetRecords(data, len, now);
+	} else {
+		addTelnetBuf(data, len);
+		lineStart = (data[len - 1] == '\n');
+	}
+#ifndef ESP8266
+	// Wake up the task for the first byte (starts the collecting time) and
+	// for a complete block
+	if (task && ((used == 0) || ((used < minBlockSize) && (bufUsed >= minBlockSize)))) {
+		notifyTask();
+	}
+#endif
+}
+
+void TelnetSpy::waitTelnetBuf(size_t size) {
+	// Sends the buffered data until "size" bytes are free, the timeout is over
+	// or no client is connected anymore
+	unsigned long startTime = micros();
+	unsigned long timeout = (unsigned long) overflowValue * 1000;
+	stats.blockCount++;
+	while (size > (size_t) (bufLen - bufUsed)) {
+		if (micros() - startTime >= timeout) {
+			// Don't wait again before the clients take data
+			stats.blockTimeouts++;
+			overflowStalled = true;
+			break;
+		}
+		if (!clientsConnected()) {
+			break;
+		}
+		// Give the network stack the time to send the data
+		delay(1);
+		lockClients();
+		sendBlock();
+		unlockClients();
+	}
+	stats.blockTime += micros() - startTime;
+}
+
+bool TelnetSpy::mayWaitTelnetBuf() {
+	// Not in interrupts, network callbacks (ESP8266 SYS context) or callbacks
+	// of handle(), they would wait for themselves
+	if (handling) {
+		return false;
+	}
+#ifdef ESP8266
+	return can_yield();
+#else
+	return !xPortInIsrContext();
+#endif
+}
+
+bool TelnetSpy::rejectLine() {
+	// Returns true, if the new line is dropped instead of the oldest lines
+	if (overflowPolicy == TELNETSPY_OVERFLOW_DROP_NEWEST) {
+		stats.linesRejected++;
+		return true;
+	}
+	if ((overflowPolicy == TELNETSPY_OVERFLOW_SAMPLE) && (++sampleCount < overflowValue)) {
+		stats.linesSampled++;
+		return true;
+	}
+	sampleCount = 0;
+	return false;
+}
+
+int TelnetSpy::available (void) {
+	if (usedSer) {
+		int avail = usedSer->available();
+		if (avail > 0) {
+			return avail;
+		}
+	}
+	if (clientsConnected()) {
+		return telnetAvailable();
+	}
+	return 0;
+}
+
+int TelnetSpy::read (void) {
+	int val = -1;
+	if (usedSer) {
+		val = usedSer->read();
+		if (val != -1) {
+			return val;
+		}
+	}
+	if (clientsConnected()) {
+		if (telnetAvailable()) {
+            if (recBuf) {
+                if (recUsed == 0) {
+                    val = -1;
+                } else {
+CRITCAL_SECTION_START
+                    val = recBuf[recRdIdx++];
+	                if (recRdIdx >= recLen) {
+		                recRdIdx = 0;
+	                }
+	                recUsed--;
+CRITCAL_SECTION_END
+                }
+            } else {
+                for (uint8_t i = 0; i < maxClients; i++) {
+                    uint8_t c;
+                    if (transport->read(i, &c, 1) == 1) {
+                        val = c;
+                        break;
+                    }
+                }
+            }
+		}
+	}
+	return val;
+}
+
+int TelnetSpy::read(uint8_t* buffer, size_t len) {
+	// Returns the number of read bytes (without waiting)
+	size_t n = 0;
+	if (usedSer) {
+		int avail;
+		while ((n < len) && ((avail = usedSer->available()) > 0)) {
+			size_t tmp = usedSer->readBytes(&buffer[n], min((size_t) avail, len - n));
+			if (tmp == 0) {
+				break;
+			}
+			n += tmp;
+		}
+	}
+	if ((n < len) && clientsConnected() && telnetAvailable()) {
+		if (recBuf) {
+CRITCAL_SECTION_START
+			size_t count = min(len - n, (size_t) recUsed);
+			size_t tmp = min(count, recLen - recRdIdx);
+			memcpy(&buffer[n], &recBuf[recRdIdx], tmp);
+			memcpy(&buffer[n + tmp], recBuf, count - tmp);
+			recRdIdx += count;
+			if (recRdIdx >= recLen) {
+				recRdIdx -= recLen;
+			}
+			recUsed -= count;
+CRITCAL_SECTION_END
+			n += count;
+		} else {
+			int c;
+			while ((n < len) && ((c = read()) != -1)) {
+				buffer[n++] = c;
+			}
+		}
+	}
+	return n;
+}
+
+size_t TelnetSpy::readBytes(char* buffer, size_t length) {
+	// Like Stream::readBytes, but reads all available data at once
+	size_t count = 0;
+	unsigned long startMillis = millis();
+	while (count < length) {
+		int n = read((uint8_t*) &buffer[count], length - count);
+		if (n > 0) {
+			count += n;
+			startMillis = millis();
+		} else if ((millis() - startMillis) >= _timeout) {
+			break;
+		} else {
+			yield();
+		}
+	}
+	return count;
+}
+
+int TelnetSpy::peek (void) {
+	int val = -1;
+	if (usedSer) {
+		val = usedSer->peek();
+		if (val != -1) {
+			return val;
+		}
+	}
+	if (clientsConnected()) {
+		if (telnetAvailable()) {
+            if (recBuf) {
+                val = recBuf[recRdIdx];
+            } else {
+                for (uint8_t i = 0; i < maxClients; i++) {
+                    if (transport->available(i) > 0) {
+                        val = transport->peek(i);
+                        break;
+                    }
+                }
+            }
+		}
+	}
+	return val;
+}
+
+void TelnetSpy::flush (void) {
+	sendSerialQueue(true);
+	if (usedSer) {
+		usedSer->flush();
+	}
+	lockClients();
+	if (clientsConnected()) {
+        sendBlock();
+		for (uint8_t i = 0; i < maxClients; i++) {
+			if (transport->connected(i)) {
+				transport->flush(i);
+			}
+		}
+    }
+	unlockClients();
+}
+
+#ifdef ESP8266
+
+void TelnetSpy::begin(unsigned long baud, SerialConfig config, SerialMode mode, uint8_t tx_pin) {
+	if (usedSer) {
+		usedSer->begin(baud, config, mode, tx_pin);
+	}
+    setDebugOutput(debugOutput);
+	started = true;
+}
+
+#else // ESP32
+
+void TelnetSpy::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert) {
+	if (usedSer) {
+		usedSer->begin(baud, config, rxPin, txPin, invert);
+	}
+    setDebugOutput(debugOutput);
+	started = true;
 }
 
 #endif
@@ -445,185 +2598,1058 @@ void TelnetSpy::end() {
 		setDebugOutput(false);
 	}
 	if (usedSer) {
-		usedSer->end();
+		usedSer->end();
+	}
+	lockClients();
+	disconnectClient();
+	transport->end();
+	listening = false;
+	started = false;
+	unlockClients();
+}
+
+#ifdef ESP8266
+
+void TelnetSpy::swap(uint8_t tx_pin) {
+	if (usedSer) {
+		usedSer->swap(tx_pin);
+	}
+}
+
+void TelnetSpy::set_tx(uint8_t tx_pin) {
+	if (usedSer) {
+		usedSer->set_tx(tx_pin);
+	}
+}
+
+void TelnetSpy::pins(uint8_t tx, uint8_t rx) {
+	if (usedSer) {
+		usedSer->pins(tx, rx);
+	}
+}
+
+bool TelnetSpy::isTxEnabled(void) {
+	if (usedSer) {
+		return usedSer->isTxEnabled();
+	}
+	return true;
+}
+
+bool TelnetSpy::isRxEnabled(void) {
+	if (usedSer) {
+		return usedSer->isRxEnabled();
+	}
+	return true;
+}
+
+#endif
+
+int TelnetSpy::availableForWrite(void) {
+	// The data which can be written without waiting for the serial port and
+	// without dropping buffered telnet data
+	int avail = 0x7FFF;
+	if (usedSer) {
+		avail = serBuf ? serLen - serUsed : usedSer->availableForWrite();
+	}
+	if (telnetBuf && (storeOffline || clientsConnected())) {
+		avail = min((size_t) avail, bufLen - bufUsed);
+	}
+	return avail;
+}
+
+TelnetSpy::operator bool() const {
+	if (usedSer) {
+		return (bool) *usedSer;
+	}
+	return true;
+}
+
+void TelnetSpy::setDebugOutput(bool en) {
+	debugOutput = en;
+	if (debugOutput) {
+		actualObject = this;
+		ets_install_putc1(TelnetSpy_putc);  // Set system printing (os_printf) to TelnetSpy
+#ifdef ESP8266
+		system_set_os_print(true);
+#endif
+	} else {
+		if (actualObject == this) {
+#ifdef ESP8266
+			system_set_os_print(false);
+#endif
+			ets_install_putc1(TelnetSpy_ignore_putc); // Ignore system printing
+			actualObject = NULL;
+		}
+	}
+}
+
+uint32_t TelnetSpy::baudRate(void) {
+	if (usedSer) {
+		return usedSer->baudRate();
 	}
-	if (client.connected()) {
-        sendBlock();
-		client.flush();
-		client.stop();
-	}
-	if (connected && (callbackDisconnect != NULL)) {
-		callbackDisconnect();
-	}	
-	connected = false;
-	telnetServer->close();
-	delete telnetServer;
-	telnetServer = NULL;
-	listening = false;
-	started = false;
+	return 115200;
 }
 
-#ifdef ESP8266
+void TelnetSpy::sendBlock() {
+	if (!telnetBuf) {
+		return;
+	}
+	unsigned long startTime = micros();
+	stats.sendBlockCalls++;
+	size_t minSent = SIZE_MAX;
+	uint16_t minBacklog = 0xFFFF;
+	uint16_t sent = 0;
+	for (uint8_t i = 0; i < maxClients; i++) {
+		if (!transport->connected(i)) {
+			continue;
+		}
+		uint16_t blockLen = maxBlockSize;
+		// Don't block the main loop: send only what fits into the TCP send buffer
+		// (if the transport reports its free space)
+		int avail = transport->availableForWrite(i);
+		if (avail >= 0) {
+			if (deflate[i]) {
+				// The compressed data must be sent completely, so reserve its maximum size
+				avail = (avail > 24) ? (avail - 24) / 9 * 8 : 0;
+			}
+			if (avail < blockLen) {
+				blockLen = avail;
+			}
+		}
+		uint16_t freeLen = blockLen;
+		if (clientReplay[i]) {
+			// The live data goes first (complete lines, between the lines of the
+			// replay), the replay gets the rest within its budget of this handle()
+			if (!clientReplayMid[i] && !(clientLiveMid[i] && (clientLiveSent[i] == clientLive[i]))) {
+				bool midLine = clientLiveMid[i];
+				uint16_t n = sendRange(i, &clientLiveSent[i], &clientLiveStamp[i], &clientLiveStampPos[i],
+						SIZE_MAX, blockLen, true, &midLine);
+				clientLiveMid[i] = midLine;
+				sent += n;
+				blockLen -= n;
+			}
+			freeLen = blockLen;
+			blockLen = min(blockLen, clientReplayLeft[i]);
+			if (clientLiveMid[i] && (clientLiveSent[i] > clientLive[i])) {
+				// A live line is sent partially
+				blockLen = 0;
+			}
+		}
+		if (clientBacklog[i] < backlogUsed) {
+			// The compressed backlog is older than the transmit buffer, so send it
+			// first (unpacked into the second half of the scratch buffer)
+			uint8_t* data = &backlogTmp[TELNETSPY_BACKLOG_BLOCK_LEN + (sizeof(uint16_t) << TELNETSPY_BACKLOG_HASH_BITS)];
+			unsigned long stamp;
+CRITCAL_SECTION_START
+			uint16_t dataLen = unpackBacklog(clientBacklog[i], data, &stamp);
+			uint16_t pos = clientBacklogPos[i];
+CRITCAL_SECTION_END
+			const uint8_t* text;
+			uint16_t len;
+			bool last;
+			if (records) {
+				// Skip the characters sent before (the position counts characters)
+				uint8_t skip = 0;
+				size_t start, raw;
+				renderRecords((const char*) data, dataLen, 0, dataLen, &stamp, &skip, NULL, pos, &start);
+				len = renderRecords((const char*) data, dataLen, start, dataLen - start, &stamp, &skip,
+						renderBuf, blockLen, &raw);
+				text = (const uint8_t*) renderBuf;
+				last = (start + raw >= dataLen) && (skip == 0);
+			} else {
+				pos = min(pos, dataLen);
+				len = min((uint16_t) (dataLen - pos), blockLen);
+				text = &data[pos];
+				last = (pos + len >= dataLen);
+			}
+			uint16_t n = writeClient(i, text, len);
+CRITCAL_SECTION_START
+			clientBacklogPos[i] += n;
+			if (last && (n == len)) {
+				clientBacklog[i] += backlogBlockSize(clientBacklog[i]);
+				clientBacklogPos[i] = 0;
+			}
+CRITCAL_SECTION_END
+			sent += n;
+			if (n > 0) {
+				countBlock(n);
+				if (clientReplay[i]) {
+					clientReplayLeft[i] -= n;
+					clientReplayMid[i] = (text[n - 1] != '\n');
+				}
+			}
+			minSent = 0;
+			minBacklog = min(minBacklog, clientBacklog[i]);
+			continue;
+		}
+		minBacklog = min(minBacklog, clientBacklog[i]);
+		if (!clientReplay[i]) {
+			sent += sendRange(i, &clientSent[i], &clientStamp[i], &clientStampPos[i], SIZE_MAX, blockLen, false, NULL);
+			minSent = min(minSent, clientSent[i]);
+			continue;
+		}
+		// The replay ends at the start of the live data, it is sent in complete
+		// lines if possible, so the live data isn't delayed
+		bool midLine = clientReplayMid[i];
+		uint16_t n = sendRange(i, &clientSent[i], &clientStamp[i], &clientStampPos[i], clientLive[i], blockLen,
+				true, &midLine);
+		if (n == 0) {
+			n = sendRange(i, &clientSent[i], &clientStamp[i], &clientStampPos[i], clientLive[i], blockLen,
+					false, &midLine);
+		}
+		clientReplayMid[i] = midLine;
+		clientReplayLeft[i] -= n;
+		sent += n;
+		if ((clientSent[i] >= clientLive[i]) && (clientStampPos[i] == 0)) {
+			if (clientReplayMid[i]) {
+				// The replay ends inside of a line
+				writeClient(i, (const uint8_t*) "\r\n", 2);
+			}
+			writeMsg(i, PSTR(TELNETSPY_LIVE_MSG), true);
+			// The client continues at the position of its live data
+CRITCAL_SECTION_START
+			clientSent[i] = clientLiveSent[i];
+			clientStamp[i] = clientLiveStamp[i];
+			clientStampPos[i] = clientLiveStampPos[i];
+			clientReplay[i] = false;
+CRITCAL_SECTION_END
+			// The live data which waited for the end of the replay follows immediately
+			sent += sendRange(i, &clientSent[i], &clientStamp[i], &clientStampPos[i], SIZE_MAX, freeLen - n,
+					false, NULL);
+		}
+		minSent = min(minSent, clientSent[i]);
+	}
+	if ((minSent != SIZE_MAX) && (minSent > 0)) {
+		// Free the data which has been sent to all connected clients
+CRITCAL_SECTION_START
+		releaseTelnetBuf(minSent);
+CRITCAL_SECTION_END
+	}
+	if ((minBacklog != 0xFFFF) && (minBacklog > 0)) {
+CRITCAL_SECTION_START
+		releaseBacklog(minBacklog);
+CRITCAL_SECTION_END
+	}
+	stats.bytesSent += sent;
+	stats.sendBlockTime += micros() - startTime;
+    if (sent == 0) {
+        return;
+    }
+	overflowStalled = false;
+	waitRef = 0xFFFFFFFF;
+	if (pingRef != 0xFFFFFFFF) {
+		pingRef = (millis() & 0x7FFFFFF) + pingTime;
+		if (pingRef > 0x7FFFFFFF) {
+			pingRef -= 0x80000000;
+		}
+	}
+}
 
-void TelnetSpy::swap(uint8_t tx_pin) {
-	if (usedSer) {
-		usedSer->swap(tx_pin);
+uint16_t TelnetSpy::sendRange(uint8_t slot, size_t* pos, unsigned long* stamp, uint8_t* stampPos,
+		size_t end, uint16_t blockLen, bool lines, bool* midLine) {
+	// Sends the transmit buffer from the cursor "pos" up to "end" (at most
+	// blockLen bytes, only complete lines if "lines" is set), moves the cursor
+	// behind the sent data and returns the number of sent bytes. midLine tells
+	// if the sent data ends inside of a line.
+CRITCAL_SECTION_START
+	end = max(min(end, (size_t) bufUsed), *pos);
+	size_t avail = end - *pos;
+	size_t idx = bufRdIdx + *pos;
+CRITCAL_SECTION_END
+	if (idx >= bufLen) {
+		idx -= bufLen;
+	}
+	uint16_t len = min(avail, (size_t) blockLen);
+	if (len == 0) {
+		return 0;
+	}
+	uint16_t n;
+	char last;
+	if (records) {
+		// The rendered timestamps make the text longer than the buffered data
+		unsigned long st = *stamp;
+		uint8_t skip = *stampPos;
+		size_t raw;
+		len = renderRecords(telnetBuf, bufLen, idx, avail, &st, &skip, renderBuf, blockLen, &raw);
+		while (lines && (len > 0) && (renderBuf[len - 1] != '\n')) {
+			len--;
+		}
+		n = writeClient(slot, (const uint8_t*) renderBuf, len);
+		if (n == 0) {
+			return 0;
+		}
+		last = renderBuf[n - 1];
+		// Move the cursor behind the sent characters
+		st = *stamp;
+		skip = *stampPos;
+		renderRecords(telnetBuf, bufLen, idx, avail, &st, &skip, NULL, n, &raw);
+CRITCAL_SECTION_START
+		*pos += raw;
+		*stamp = st;
+		*stampPos = skip;
+CRITCAL_SECTION_END
+	} else {
+		while (lines && (len > 0) && (telnetBuf[(idx + len - 1 < bufLen) ? idx + len - 1 : idx + len - 1 - bufLen] != '\n')) {
+			len--;
+		}
+		if (len == 0) {
+			return 0;
+		}
+		// If the data wraps around the end of the ring buffer, send both
+		// segments now instead of leaving the second one for the next call
+		uint16_t tmp = min((size_t) len, bufLen - idx);
+		n = writeClient(slot, (const uint8_t*) &telnetBuf[idx], tmp);
+		if ((n == tmp) && (tmp < len)) {
+			n += writeClient(slot, (const uint8_t*) telnetBuf, len - tmp);
+		}
+		if (n == 0) {
+			return 0;
+		}
+		last = telnetBuf[(idx + n - 1 < bufLen) ? idx + n - 1 : idx + n - 1 - bufLen];
+		// Data not accepted by the client stays in the buffer for the next call
+CRITCAL_SECTION_START
+		*pos = min(*pos + n, (size_t) bufUsed);
+CRITCAL_SECTION_END
 	}
+	if (midLine) {
+		*midLine = (last != '\n');
+	}
+	countBlock(n);
+	return n;
 }
 
-void TelnetSpy::set_tx(uint8_t tx_pin) {
-	if (usedSer) {
-		usedSer->set_tx(tx_pin);
+void TelnetSpy::countBlock(uint16_t len) {
+	uint8_t cls = 0;
+	for (len >>= 4; len && (cls < TELNETSPY_STATS_BLOCK_CLASSES - 1); len >>= 2) {
+		cls++;
 	}
+	stats.blockSizes[cls]++;
 }
 
-void TelnetSpy::pins(uint8_t tx, uint8_t rx) {
-	if (usedSer) {
-		usedSer->pins(tx, rx);
+void TelnetSpy::addTelnetBuf(char c) {
+CRITCAL_SECTION_START
+	if (bufUsed == bufLen) {
+		releaseTelnetBuf(1);
+		stats.bytesEvicted++;
+	}
+	telnetBuf[bufWrIdx] = c;
+	bufUsed++;
+	bufWrIdx++;
+	if (bufWrIdx >= bufLen) {
+		bufWrIdx = 0;
+	}
+	if (bufUsed > stats.peakBufUsed) {
+		stats.peakBufUsed = bufUsed;
 	}
+CRITCAL_SECTION_END
 }
 
-bool TelnetSpy::isTxEnabled(void) {
-	if (usedSer) {
-		return usedSer->isTxEnabled();
+void TelnetSpy::addTelnetBuf(const uint8_t* data, size_t len) {
+	if (len > bufLen) {
+		// Only the youngest data fits into the buffer
+		data += len - bufLen;
+		len = bufLen;
+	}
+CRITCAL_SECTION_START
+	if (bufUsed + len > bufLen) {
+		stats.bytesEvicted += bufUsed + len - bufLen;
+		releaseTelnetBuf(bufUsed + len - bufLen);
+	}
+	size_t tmp = min(len, bufLen - bufWrIdx);
+	memcpy(&telnetBuf[bufWrIdx], data, tmp);
+	if (tmp < len) {
+		memcpy(telnetBuf, &data[tmp], len - tmp);
+	}
+	bufWrIdx += len;
+	if (bufWrIdx >= bufLen) {
+		bufWrIdx -= bufLen;
+	}
+	bufUsed += len;
+	if (bufUsed > stats.peakBufUsed) {
+		stats.peakBufUsed = bufUsed;
+	}
+CRITCAL_SECTION_END
+}
+
+void TelnetSpy::dropTelnetLine() {
+CRITCAL_SECTION_START
+	size_t len = bufUsed;
+	size_t idx = bufRdIdx;
+	// Search the end of the oldest line in both segments of the ring buffer
+	size_t tmp = min(len, bufLen - idx);
+	char* p = (char*) memchr(&telnetBuf[idx], '\n', tmp);
+	size_t n = len;
+	if (p) {
+		n = p - &telnetBuf[idx] + 1;
+	} else if (tmp < len) {
+		p = (char*) memchr(telnetBuf, '\n', len - tmp);
+		if (p) {
+			n = tmp + (p - telnetBuf) + 1;
+		}
+	}
+	idx += n;
+	if (idx >= bufLen) {
+		idx -= bufLen;
+	}
+	if ((n < len) && (telnetBuf[idx] == '\r')) {
+		n++;
+	}
+	releaseTelnetBuf(n);
+	stats.bytesEvicted += n;
+	stats.linesEvicted++;
+CRITCAL_SECTION_END
+}
+
+bool TelnetSpy::evictTelnetLine(uint8_t level) {
+	// Removes the oldest line of the lowest severity, returns false if there
+	// are lines of a higher severity than "level" only
+	if (!severities) {
+		dropTelnetLine();
+		return true;
+	}
+CRITCAL_SECTION_START
+	size_t len = bufUsed;
+	if (len == 0) {
+CRITCAL_SECTION_END
+		return false;
+	}
+	// Lines which are already started to send to a client are not removed out of order
+	size_t from = 0;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		from = max(from, clientSent[i] + (clientStampPos[i] ? 1 : 0));
+		if (clientReplay[i]) {
+			from = max(from, clientLiveSent[i] + (clientLiveStampPos[i] ? 1 : 0));
+		}
+	}
+	uint32_t value = 0;
+	uint8_t lvl = 0;
+	size_t off = 0;
+	if (telnetBuf[bufRdIdx] == TELNETSPY_RECORD_MARK) {
+		off = recordAt(telnetBuf, bufLen, bufRdIdx, &value, &lvl);
+	}
+	// A part of a line without header at the start of the buffer is removed first
+	size_t line = 0;
+	uint8_t lineLevel = value ? lvl : 0;
+	uint32_t lineValue = value;
+	size_t best = 0;
+	uint8_t bestLevel = lineLevel;
+	uint32_t bestValue = 0;
+	size_t next = 0;
+	uint8_t nextLen = 0;
+	uint8_t nextLevel = 0;
+	uint32_t nextValue = 0;
+	while ((off < len) && (bestLevel > 0)) {
+		size_t idx = bufRdIdx + off;
+		if (idx >= bufLen) {
+			idx -= bufLen;
+		}
+		size_t tmp = min(len - off, bufLen - idx);
+		char* p = (char*) memchr(&telnetBuf[idx], TELNETSPY_RECORD_MARK, tmp);
+		if (!p) {
+			off += tmp;
+			continue;
+		}
+		off += p - &telnetBuf[idx];
+		uint8_t n = recordAt(telnetBuf, bufLen, p - telnetBuf, &value, &lvl);
+		if (value > 0) {
+			// The actual line is followed by another one, so it is complete
+			if ((line > 0) && (line >= from) && (lineLevel < bestLevel)) {
+				best = line;
+				bestLevel = lineLevel;
+				bestValue = lineValue;
+				next = off;
+				nextLen = n;
+				nextLevel = lvl;
+				nextValue = value;
+			}
+			line = off;
+			lineLevel = lvl;
+			lineValue = value;
+		}
+		off += n;
+	}
+	if (bestLevel > level) {
+CRITCAL_SECTION_END
+		return false;
+	}
+	if (best == 0) {
+CRITCAL_SECTION_END
+		dropTelnetLine();
+		return true;
+	}
+	// Replace the header of the next line by one with the time of both
+	// headers, then move the older data over the removed line
+	uint8_t hdr[TELNETSPY_RECORD_HEADER_LEN];
+	uint8_t hdrLen = recordHeader(hdr, bestValue + nextValue - 2, nextLevel);
+	size_t n = next + nextLen - hdrLen - best;
+	size_t idx = bufRdIdx + best + n;
+	if (idx >= bufLen) {
+		idx -= bufLen;
+	}
+	for (uint8_t i = 0; i < hdrLen; i++) {
+		telnetBuf[idx] = hdr[i];
+		if (++idx >= bufLen) {
+			idx = 0;
+		}
+	}
+	moveTelnetBuf(best, n);
+	bufRdIdx += n;
+	if (bufRdIdx >= bufLen) {
+		bufRdIdx -= bufLen;
+	}
+	bufUsed -= n;
+	bufChanges++;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (connected[i]) {
+			clientDropped[i] += next - best;
+		}
+		if (clientLive[i] > best) {
+			// The live data starts behind the removed line
+			clientLive[i] = (clientLive[i] >= best + n) ? clientLive[i] - n : best;
+		}
 	}
+	stats.bytesEvicted += n;
+	stats.linesEvicted++;
+CRITCAL_SECTION_END
 	return true;
 }
 
-bool TelnetSpy::isRxEnabled(void) {
-	if (usedSer) {
-		return usedSer->isRxEnabled();
+void TelnetSpy::moveTelnetBuf(size_t len, size_t dist) {
+	// Moves the oldest "len" bytes of the buffer "dist" bytes towards the
+	// youngest ones, must be called inside of the critical section
+	size_t src = bufRdIdx + len;
+	if (src >= bufLen) {
+		src -= bufLen;
+	}
+	size_t dst = src + dist;
+	if (dst >= bufLen) {
+		dst -= bufLen;
+	}
+	while (len > 0) {
+		if (src == 0) {
+			src = bufLen;
+		}
+		if (dst == 0) {
+			dst = bufLen;
+		}
+		size_t tmp = min(len, min(src, dst));
+		src -= tmp;
+		dst -= tmp;
+		memmove(&telnetBuf[dst], &telnetBuf[src], tmp);
+		len -= tmp;
+	}
+}
+
+void TelnetSpy::releaseTelnetBuf(size_t len) {
+	// Must be called inside of the critical section
+	if (timestamps) {
+		bufStamp = skipRecords(bufRdIdx, len, bufStamp);
+	}
+	bufRdIdx += len;
+	if (bufRdIdx >= bufLen) {
+		bufRdIdx -= bufLen;
+	}
+	bufUsed -= len;
+	bufChanges++;
+#ifndef TELNETSPY_LOCK_FREE
+	if (bufUsed == 0) {
+		bufRdIdx = 0;
+		bufWrIdx = 0;
+	}
+#endif
+	skipClientCursors(len);
+}
+
+void TelnetSpy::packTelnetBuf(size_t size) {
+	// Removes the oldest data which doesn't fit into "size" bytes and moves
+	// the rest to the start of the buffer without any additional memory
+	if (records) {
+		// Don't cut a record header
+		while (bufUsed > size) {
+			evictTelnetLine(TELNETSPY_SEVERITY_ERROR);
+		}
+	}
+	if (bufUsed > size) {
+CRITCAL_SECTION_START
+		stats.bytesEvicted += bufUsed - size;
+		releaseTelnetBuf(bufUsed - size);
+CRITCAL_SECTION_END
+	}
+	if ((bufUsed > 0) && (bufRdIdx > 0)) {
+		if (bufRdIdx + bufUsed <= bufLen) {
+			memmove(telnetBuf, &telnetBuf[bufRdIdx], bufUsed);
+		} else {
+			// Rotate the wrapped data: reverse both parts, then the whole buffer
+			TelnetSpy_reverse(telnetBuf, bufRdIdx);
+			TelnetSpy_reverse(&telnetBuf[bufRdIdx], bufLen - bufRdIdx);
+			TelnetSpy_reverse(telnetBuf, bufLen);
+		}
+	}
+	bufRdIdx = 0;
+	bufWrIdx = bufUsed;
+	bufChanges++;
+}
+
+void TelnetSpy::skipClientCursors(size_t len) {
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clientLive[i] -= min(clientLive[i], len);
+		if (clientLiveSent[i] >= len) {
+			clientLiveSent[i] -= len;
+		} else {
+			clientLiveSent[i] = 0;
+			clientLiveStamp[i] = bufStamp;
+			clientLiveStampPos[i] = 0;
+		}
+		if (clientSent[i] >= len) {
+			clientSent[i] -= len;
+		} else {
+			if (connected[i]) {
+				clientDropped[i] += len - clientSent[i];
+			}
+			clientSent[i] = 0;
+			clientStamp[i] = bufStamp;
+			clientStampPos[i] = 0;
+		}
+	}
+}
+
+// In timestamp mode every line in the transmit buffer starts with a record
+// header: TELNETSPY_RECORD_MARK followed by the time since the previous
+// header + 1 as varint (LSB first, 4 bits in the first byte together with
+// the severity in bits 4 and 5, 6 bits in the following ones, bit 6 => more
+// bytes follow, bit 7 always set, so a header never contains '\n' or the
+// mark). Without timestamps the time is always 0. A data byte equal to
+// TELNETSPY_RECORD_MARK is stored as TELNETSPY_RECORD_MARK, 0.
+
+size_t TelnetSpy::recordSize(const uint8_t* data, size_t len, unsigned long now) {
+	size_t size = len;
+	bool start = lineStart;
+	uint8_t hdr[TELNETSPY_RECORD_HEADER_LEN];
+	// Only the first header has a time difference, the others are 0
+	uint8_t hdrLen = recordHeader(hdr, timestamps ? now - lastStamp : 0, severity);
+	for (size_t i = 0; i < len; i++) {
+		if (start) {
+			size += hdrLen;
+			hdrLen = 2;
+			start = false;
+		}
+		if (data[i] == TELNETSPY_RECORD_MARK) {
+			size++;
+		} else if (data[i] == '\n') {
+			start = true;
+		}
+	}
+	return size;
+}
+
+uint8_t TelnetSpy::recordHeader(uint8_t* hdr, unsigned long delta, uint8_t level) {
+	uint8_t n = 0;
+	hdr[n++] = TELNETSPY_RECORD_MARK;
+	uint32_t v = delta + 1;
+	uint8_t b = 0x80 | ((level & 0x03) << 4) | (v & 0x0F);
+	v >>= 4;
+	while (v > 0) {
+		hdr[n++] = b | 0x40;
+		b = 0x80 | (v & 0x3F);
+		v >>= 6;
+	}
+	hdr[n++] = b;
+	return n;
+}
+
+void TelnetSpy::addTelnetRecords(const uint8_t* data, size_t len, unsigned long now) {
+	uint8_t hdr[TELNETSPY_RECORD_HEADER_LEN];
+	size_t run = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (lineStart) {
+			addTelnetBuf(hdr, recordHeader(hdr, timestamps ? now - lastStamp : 0, severity));
+			lastStamp = now;
+			lineStart = false;
+		}
+		if (data[i] == TELNETSPY_RECORD_MARK) {
+			addTelnetBuf(&data[run], i - run + 1);
+			addTelnetBuf((uint8_t) 0);
+			run = i + 1;
+		} else if (data[i] == '\n') {
+			addTelnetBuf(&data[run], i - run + 1);
+			run = i + 1;
+			lineStart = true;
+		}
+	}
+	if (run < len) {
+		addTelnetBuf(&data[run], len - run);
+	}
+}
+
+uint16_t TelnetSpy::recordAt(const char* buf, size_t size, size_t idx, uint32_t* value, uint8_t* level) {
+	// Returns the size of the record header at idx of the ring buffer "buf" of
+	// "size" bytes, its value (0 => escaped data byte) and its severity
+	if (++idx >= size) {
+		idx = 0;
+	}
+	uint8_t b = buf[idx];
+	*value = 0;
+	*level = 0;
+	if (!(b & 0x80)) {
+		// Escaped data byte
+		return 2;
+	}
+	*level = (b >> 4) & 0x03;
+	*value = b & 0x0F;
+	uint16_t n = 2;
+	uint8_t shift = 4;
+	while (b & 0x40) {
+		if (++idx >= size) {
+			idx = 0;
+		}
+		b = buf[idx];
+		*value |= (uint32_t) (b & 0x3F) << shift;
+		shift += 6;
+		n++;
+	}
+	return n;
+}
+
+unsigned long TelnetSpy::skipRecords(size_t idx, size_t len, unsigned long stamp) {
+	uint32_t value;
+	uint8_t level;
+	while (len > 0) {
+		size_t tmp = min(len, bufLen - idx);
+		char* p = (char*) memchr(&telnetBuf[idx], TELNETSPY_RECORD_MARK, tmp);
+		if (!p) {
+			len -= tmp;
+			idx += tmp;
+			if (idx >= bufLen) {
+				idx = 0;
+			}
+			continue;
+		}
+		len -= p - &telnetBuf[idx];
+		idx = p - telnetBuf;
+		uint16_t n = recordAt(telnetBuf, bufLen, idx, &value, &level);
+		if (value > 0) {
+			stamp += value - 1;
+		}
+		len -= min((size_t) n, len);
+		idx += n;
+		if (idx >= bufLen) {
+			idx -= bufLen;
+		}
+	}
+	return stamp;
+}
+
+size_t TelnetSpy::renderRecords(const char* buf, size_t bufSize, size_t idx, size_t avail,
+		unsigned long* stamp, uint8_t* skip, char* out, size_t outLen, size_t* raw) {
+	// Converts "avail" bytes of records at idx of the ring buffer "buf" into
+	// the text to send. "stamp" and "skip" are the time at idx and the number
+	// of already sent characters of its timestamp, both are updated. With out
+	// == NULL the text isn't stored: use it to get the amount of buffered data
+	// ("raw") of the given number of characters.
+	*raw = 0;
+	size_t n = 0;
+	while ((*raw < avail) && (n < outLen)) {
+		char c = buf[idx];
+		uint16_t size = 1;
+		if (c == TELNETSPY_RECORD_MARK) {
+			uint32_t value;
+			uint8_t level;
+			size = recordAt(buf, bufSize, idx, &value, &level);
+			if (value > 0) {
+				char tmp[24];
+				unsigned long t = *stamp + value - 1;
+				uint8_t len = 0;
+				if (severityMarks) {
+					tmp[len++] = (char) 255;
+					tmp[len++] = level;
+				}
+				if (timestamps) {
+					len += snprintf(&tmp[len], sizeof(tmp) - len, "[%02lu:%02lu:%02lu.%03lu] ", t / 3600000,
+							(t / 60000) % 60, (t / 1000) % 60, t % 1000);
+				}
+				uint8_t copy = min((size_t) (len - *skip), outLen - n);
+				if (out) {
+					memcpy(&out[n], &tmp[*skip], copy);
+				}
+				n += copy;
+				if (*skip + copy < len) {
+					// Only a part of the timestamp fits
+					*skip += copy;
+					break;
+				}
+				*skip = 0;
+				*stamp = t;
+				*raw += size;
+				idx += size;
+				if (idx >= bufSize) {
+					idx -= bufSize;
+				}
+				continue;
+			}
+		}
+		if (out) {
+			out[n] = c;
+		}
+		n++;
+		*raw += size;
+		idx += size;
+		if (idx >= bufSize) {
+			idx -= bufSize;
+		}
+	}
+	return n;
+}
+
+bool TelnetSpy::compressTelnetBuf() {
+	// Moves the oldest complete lines of the transmit buffer into a new block
+	// of the compressed backlog, returns false if this isn't possible. The
+	// lines are copied and packed outside of the critical section, so the
+	// writers and the spinlock aren't held up by the compression.
+	uint8_t* data = backlogTmp;
+CRITCAL_SECTION_START
+	if (backlogBusy) {
+CRITCAL_SECTION_END
+		return false;
+	}
+	uint16_t len = min((size_t) bufUsed, (size_t) TELNETSPY_BACKLOG_BLOCK_LEN);
+	size_t rdIdx = bufRdIdx;
+	unsigned long stamp = bufStamp;
+	uint16_t tmp = min((size_t) len, bufLen - rdIdx);
+	memcpy(data, &telnetBuf[rdIdx], tmp);
+	memcpy(&data[tmp], telnetBuf, len - tmp);
+	// A record header never contains '\n'
+	while ((len > 0) && (data[len - 1] != '\n')) {
+		len--;
+	}
+	if ((len == 0) || (len + TELNETSPY_BACKLOG_HEADER_LEN > backlogLen)) {
+CRITCAL_SECTION_END
+		return false;
+	}
+	// Pack the data directly behind the existing blocks, it must get smaller
+	while (backlogUsed + len + TELNETSPY_BACKLOG_HEADER_LEN > backlogLen) {
+		// Drop the oldest block
+		stats.bytesEvicted += backlogBuf[backlogStart] | (backlogBuf[backlogStart + 1] << 8);
+		releaseBacklog(backlogBlockSize(0));
+	}
+	if (backlogStart + backlogUsed + len + TELNETSPY_BACKLOG_HEADER_LEN > backlogLen) {
+		// No space behind the last block: move the blocks to the start
+		memmove(backlogBuf, &backlogBuf[backlogStart], backlogUsed);
+		backlogStart = 0;
+	}
+	uint8_t* block = &backlogBuf[backlogStart + backlogUsed];
+	backlogBusy = true;
+CRITCAL_SECTION_END
+	uint16_t size = TelnetSpy_pack(data, len, &block[TELNETSPY_BACKLOG_HEADER_LEN], len,
+			(uint16_t*) &backlogTmp[TELNETSPY_BACKLOG_BLOCK_LEN]);
+	// Block header: size of the data and of the packed data, time at the
+	// start of the data (all LSB first)
+	block[0] = len & 0xFF;
+	block[1] = len >> 8;
+	block[2] = size & 0xFF;
+	block[3] = size >> 8;
+	for (uint8_t i = 0; i < 4; i++) {
+		block[4 + i] = (stamp >> (8 * i)) & 0xFF;
+	}
+CRITCAL_SECTION_START
+	backlogBusy = false;
+	// The packed lines must still be the oldest ones of the transmit buffer
+	bool valid = (size > 0) && (bufRdIdx == rdIdx) && (bufStamp == stamp) && (bufUsed >= len)
+			&& (memcmp(data, &telnetBuf[rdIdx], min((size_t) len, bufLen - rdIdx)) == 0)
+			&& ((len <= bufLen - rdIdx) || (memcmp(&data[bufLen - rdIdx], telnetBuf, len - (bufLen - rdIdx)) == 0));
+	if (valid) {
+		backlogUsed += TELNETSPY_BACKLOG_HEADER_LEN + size;
+		releaseTelnetBuf(len);
+		stats.bytesCompressed += len;
+		stats.compressedSize += TELNETSPY_BACKLOG_HEADER_LEN + size;
+	}
+CRITCAL_SECTION_END
+	return valid;
+}
+
+uint16_t TelnetSpy::unpackBacklog(uint16_t pos, uint8_t* data, unsigned long* stamp) {
+	// Returns the size of the data of the block at pos, must be called inside
+	// of the critical section
+	uint8_t* block = &backlogBuf[backlogStart + pos];
+	*stamp = 0;
+	for (uint8_t i = 0; i < 4; i++) {
+		*stamp |= (unsigned long) block[4 + i] << (8 * i);
+	}
+	return TelnetSpy_unpack(&block[TELNETSPY_BACKLOG_HEADER_LEN], block[2] | (block[3] << 8), data,
+			min((uint16_t) (block[0] | (block[1] << 8)), (uint16_t) TELNETSPY_BACKLOG_BLOCK_LEN));
+}
+
+uint16_t TelnetSpy::backlogBlockSize(uint16_t pos) {
+	pos += backlogStart;
+	return TELNETSPY_BACKLOG_HEADER_LEN + (backlogBuf[pos + 2] | (backlogBuf[pos + 3] << 8));
+}
+
+void TelnetSpy::releaseBacklog(uint16_t len) {
+	// Must be called inside of the critical section, the blocks stay in place
+	// (see compressTelnetBuf)
+	backlogUsed -= len;
+	backlogStart = (backlogUsed || backlogBusy) ? backlogStart + len : 0;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clientBacklog[i] >= len) {
+			clientBacklog[i] -= len;
+		} else {
+			clientBacklog[i] = 0;
+			clientBacklogPos[i] = 0;
+		}
+	}
+}
+
+void TelnetSpy::setTimestamps(bool enable) {
+	if (enable != timestamps) {
+		setRecords(enable, severities);
+	}
+}
+
+bool TelnetSpy::getTimestamps() {
+	return timestamps;
+}
+
+void TelnetSpy::setSeverity(uint8_t level) {
+	severity = min(level, (uint8_t) TELNETSPY_SEVERITY_ERROR);
+}
+
+uint8_t TelnetSpy::getSeverity() {
+	return severity;
+}
+
+void TelnetSpy::setSeverityThreshold(uint8_t level) {
+	severityThreshold = level;
+}
+
+uint8_t TelnetSpy::getSeverityThreshold() {
+	return severityThreshold;
+}
+
+void TelnetSpy::setPriorityEviction(bool enable) {
+	if (enable != severities) {
+		setRecords(timestamps, enable);
 	}
-	return true;
 }
 
-#endif
+bool TelnetSpy::getPriorityEviction() {
+	return severities;
+}
 
-int TelnetSpy::availableForWrite(void) {
-	if (usedSer) {
-		return min(usedSer->availableForWrite(), bufLen - bufUsed);
+void TelnetSpy::setOverflowPolicy(uint8_t policy, uint16_t value) {
+	if (value == 0) {
+		if (policy == TELNETSPY_OVERFLOW_BLOCK) {
+			value = TELNETSPY_OVERFLOW_TIMEOUT;
+		} else if (policy == TELNETSPY_OVERFLOW_SAMPLE) {
+			value = TELNETSPY_OVERFLOW_SAMPLING;
+		}
 	}
-	return bufLen - bufUsed;
+	overflowPolicy = policy;
+	overflowValue = value;
+	sampleCount = 0;
+	overflowStalled = false;
 }
 
-TelnetSpy::operator bool() const {
-	if (usedSer) {
-		return (bool) *usedSer;
-	}
-	return true;
+uint8_t TelnetSpy::getOverflowPolicy() {
+	return overflowPolicy;
 }
 
-void TelnetSpy::setDebugOutput(bool en) {
-	debugOutput = en;
-	if (debugOutput) {
-		actualObject = this;
-		ets_install_putc1(TelnetSpy_putc);  // Set system printing (os_printf) to TelnetSpy
-#ifdef ESP8266
-		system_set_os_print(true);
-#endif
-	} else {
-		if (actualObject == this) {
-#ifdef ESP8266
-			system_set_os_print(false);
-#endif
-			ets_install_putc1(TelnetSpy_ignore_putc); // Ignore system printing
-			actualObject = NULL;
+void TelnetSpy::setRecords(bool useTimestamps, bool useSeverities) {
+	// The buffered data is stored in another format, so it is cleared
+	bool useRecords = useTimestamps || useSeverities || severityMarks;
+	if (useRecords && !renderBuf) {
+		renderBuf = (char*) malloc(maxBlockSize);
+		if (!renderBuf) {
+			return;
 		}
 	}
+	clearBuffer();
+	timestamps = useTimestamps;
+	severities = useSeverities;
+	records = useRecords;
+	lineStart = true;
+	skipLine = false;
+	lastStamp = millis();
+	bufStamp = lastStamp;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clientStamp[i] = lastStamp;
+		clientStampPos[i] = 0;
+		clientLiveStamp[i] = lastStamp;
+		clientLiveStampPos[i] = 0;
+	}
 }
 
-uint32_t TelnetSpy::baudRate(void) {
-	if (usedSer) {
-		return usedSer->baudRate();
+bool TelnetSpy::clientsConnected() {
+	for (uint8_t i = 0; i < maxClients; i++) {
+		if (transport->connected(i)) {
+			return true;
+		}
 	}
-	return 115200;
+	return false;
 }
 
-void TelnetSpy::sendBlock() {
-CRITCAL_SECTION_START
-	uint16_t len = bufUsed;
-	if (len > maxBlockSize) {
-		len = maxBlockSize;
-	}
-	len = min(len, (uint16_t) (bufLen - bufRdIdx));
-	uint16_t idx = bufRdIdx;
-CRITCAL_SECTION_END
-    if (len == 0) {
-        return;
+int TelnetSpy::telnetAvailable() {
+    if (recBuf) {
+        // Received data is parsed by handle() anyway, so only fetch more if
+        // the buffer is empty
+        if (recUsed == 0) {
+            checkReceive();
+        }
+        return recUsed;
     }
-	client.write(&telnetBuf[idx], len);
-CRITCAL_SECTION_START
-	bufRdIdx += len;
-	if (bufRdIdx >= bufLen) {
-		bufRdIdx = 0;
-	}
-	bufUsed -= len;
-	if (bufUsed == 0) {
-		bufRdIdx = 0;
-		bufWrIdx = 0;
-	}
-CRITCAL_SECTION_END
-	waitRef = 0xFFFFFFFF;
-	if (pingRef != 0xFFFFFFFF) {
-		pingRef = (millis() & 0x7FFFFFF) + pingTime;
-		if (pingRef > 0x7FFFFFFF) {
-			pingRef -= 0x80000000;
+    checkReceive();
+	for (uint8_t i = 0; i < maxClients; i++) {
+		int n = transport->available(i);
+		if (n > 0) {
+			return n;
 		}
 	}
+	return 0;
 }
 
-void TelnetSpy::addTelnetBuf(char c) {
-CRITCAL_SECTION_START
-	telnetBuf[bufWrIdx] = c;
-	if (bufUsed == bufLen) {
-		bufRdIdx++;
-		if (bufRdIdx >= bufLen) {
-			bufRdIdx = 0;
-		}
-	} else {
-		bufUsed++;
-	}
-	bufWrIdx++;
-	if (bufWrIdx >= bufLen) {
-		bufWrIdx = 0;
-	}
-CRITCAL_SECTION_END
+bool TelnetSpy::isClientConnected() {
+	return getClientCount() > 0;
 }
 
-char TelnetSpy::pullTelnetBuf() {
-	if (bufUsed == 0) {
-		return 0;
+void TelnetSpy::setMaxClients(uint8_t maxCount) {
+	maxCount = min(max((uint8_t) 1, maxCount), (uint8_t) TELNETSPY_MAX_CLIENTS);
+	for (uint8_t i = maxCount; i < maxClients; i++) {
+		disconnectClient(i);
 	}
-CRITCAL_SECTION_START
-	char c = telnetBuf[bufRdIdx++]; 
-	if (bufRdIdx >= bufLen) {
-		bufRdIdx = 0;
+	maxClients = maxCount;
+}
+
+uint8_t TelnetSpy::getMaxClients() {
+	return maxClients;
+}
+
+uint8_t TelnetSpy::getClientCount() {
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < maxClients; i++) {
+		if (connected[i]) {
+			count++;
+		}
 	}
-	bufUsed--;
-CRITCAL_SECTION_END
-	return c;
+	return count;
 }
 
-char TelnetSpy::peekTelnetBuf() {
-	if (bufUsed == 0) {
+uint32_t TelnetSpy::getDroppedCount(uint8_t slot) {
+	if (slot >= TELNETSPY_MAX_CLIENTS) {
 		return 0;
 	}
-CRITCAL_SECTION_START
-    char c = telnetBuf[bufRdIdx];
-CRITCAL_SECTION_END
-    return c;
+	return clientDropped[slot];
 }
 
-int TelnetSpy::telnetAvailable() {
-    checkReceive();
-    if (recBuf) {
-        return recUsed;
-    }
-	return client.available();
+TelnetSpyStats TelnetSpy::getStats() {
+CRITCAL_SECTION_START
+	TelnetSpyStats snapshot = stats;
+CRITCAL_SECTION_END
+	return snapshot;
 }
 
-bool TelnetSpy::isClientConnected() {
-	return connected;
+void TelnetSpy::resetStats() {
+CRITCAL_SECTION_START
+	memset(&stats, 0, sizeof(stats));
+	stats.peakBufUsed = bufUsed;
+CRITCAL_SECTION_END
 }
 
 void TelnetSpy::setCallbackOnConnect(void (*callback)()) {
@@ -635,38 +3661,72 @@ void TelnetSpy::setCallbackOnDisconnect(void (*callback)()) {
 }
 
 void TelnetSpy::disconnectClient() {
-    if (client.connected()) {
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		disconnectClient(i);
+	}
+}
+
+void TelnetSpy::disconnectClient(uint8_t slot) {
+	if (slot >= TELNETSPY_MAX_CLIENTS) {
+		return;
+	}
+	lockClients();
+    if (transport->connected(slot)) {
         sendBlock();
-        client.flush();
-        client.stop();
+        transport->flush(slot);
+        transport->stop(slot);
     }
-    if (connected && (callbackDisconnect != NULL)) {
+    if (connected[slot] && (callbackDisconnect != NULL)) {
         callbackDisconnect();
     }
-    connected = false;
+    connected[slot] = false;
+    resetClient(slot);
+    if (!isClientConnected()) {
+		pingRef = 0xFFFFFFFF;
+		waitRef = 0xFFFFFFFF;
+    }
+	unlockClients();
 }
 
 void TelnetSpy::clearBuffer() {
+CRITCAL_SECTION_START
 	bufUsed = 0;
 	bufRdIdx = 0;
 	bufWrIdx = 0;
+	bufStamp = lastStamp;
+	bufChanges++;
+	backlogStart = 0;
+	backlogUsed = 0;
+	for (uint8_t i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clientSent[i] = 0;
+		clientStamp[i] = bufStamp;
+		clientStampPos[i] = 0;
+		clientLive[i] = 0;
+		clientReplay[i] = false;
+		clientLiveSent[i] = 0;
+		clientLiveStamp[i] = bufStamp;
+		clientLiveStampPos[i] = 0;
+		clientBacklog[i] = 0;
+		clientBacklogPos[i] = 0;
+	}
+CRITCAL_SECTION_END
 }
 
 void TelnetSpy::setFilter(char ch, const char* msg, void (*callback)()) {
     filterChar = ch;
-    if (filterMsg) {
-        free(filterMsg);
-    }
-    filterMsg = strdup(msg);
+    TelnetSpy_setMsg(&filterMsg, &filterMsgFlash, msg, false);
     filterCallback = callback;
 }
 
 void TelnetSpy::setFilter(char ch, const String& msg, void (*callback)()) {
     filterChar = ch;
-    if (filterMsg) {
-        free(filterMsg);
-    }
-    filterMsg = strdup(msg.c_str());
+    TelnetSpy_setMsg(&filterMsg, &filterMsgFlash, msg.c_str(), false);
+    filterCallback = callback;
+}
+
+void TelnetSpy::setFilter(char ch, const __FlashStringHelper* msg, void (*callback)()) {
+    filterChar = ch;
+    TelnetSpy_setMsg(&filterMsg, &filterMsgFlash, (const char*) msg, true);
     filterCallback = callback;
 }
 
@@ -707,6 +3767,148 @@ void TelnetSpy::setCallbackOnNvtWWDD(void (*callback)(char command, char option)
 }
 
 void TelnetSpy::handle() {
+#ifndef ESP8266
+	if (task && (xTaskGetCurrentTaskHandle() != task)) {
+		// Done by the task (see startTask)
+		return;
+	}
+#endif
+	unsigned long startTime = micros();
+	sendSerialQueue(false);
+	lockClients();
+	handling = true;
+	handleConnection();
+	handling = false;
+	unlockClients();
+	stats.handleTime += micros() - startTime;
+}
+
+void TelnetSpy::lockClients() {
+	// In task mode the clients are used by the task and by the caller of
+	// flush, disconnectClient, ... (the lock is recursive)
+#ifndef ESP8266
+	if (taskMutex) {
+		xSemaphoreTakeRecursive(taskMutex, portMAX_DELAY);
+	}
+#endif
+}
+
+void TelnetSpy::unlockClients() {
+#ifndef ESP8266
+	if (taskMutex) {
+		xSemaphoreGiveRecursive(taskMutex);
+	}
+#endif
+}
+
+#ifndef ESP8266
+
+bool TelnetSpy::startTask(uint8_t core, uint8_t priority, uint32_t stackSize) {
+	if (task) {
+		return true;
+	}
+	if (!telnetBuf || !recBuf) {
+		return false;
+	}
+	if (!taskMutex) {
+		taskMutex = xSemaphoreCreateRecursiveMutex();
+		if (!taskMutex) {
+			return false;
+		}
+	}
+	taskStop = false;
+	if (xTaskCreatePinnedToCore(taskLoop, "TelnetSpy", stackSize, this, priority, &task, core) != pdPASS) {
+		task = NULL;
+		return false;
+	}
+	transport->setWakeup(wakeupTask, this);
+	return true;
+}
+
+void TelnetSpy::stopTask() {
+	if (!task || (xTaskGetCurrentTaskHandle() == task)) {
+		return;
+	}
+	transport->setWakeup(NULL, NULL);
+	taskStop = true;
+	xTaskNotifyGive(task);
+	while (task) {
+		delay(1);
+	}
+}
+
+void TelnetSpy::taskLoop(void* arg) {
+	// Calls handle() if write() or the transport signals something (see
+	// notifyTask) or at the next deadline of handle()
+	TelnetSpy* spy = (TelnetSpy*) arg;
+	while (!spy->taskStop) {
+		spy->handle();
+		// Without deadline the task sleeps until it is notified
+		uint32_t wait = 0xFFFFFFFF;
+		bool polled = spy->transport->polled();
+		if (spy->clientsConnected()) {
+			if (polled) {
+				// Receive data and notice disconnects
+				wait = TELNETSPY_TASK_POLL_TIME;
+			}
+			bool pending = false;
+			for (uint8_t i = 0; i < spy->maxClients; i++) {
+				pending |= spy->deflate[i] && (spy->deflate[i]->pendingLen > 0);
+			}
+			if ((spy->bufUsed >= spy->minBlockSize) || (spy->backlogUsed > 0) || pending) {
+				// The data didn't fit into the TCP send buffer
+				wait = 1;
+			}
+			unsigned long m = millis() & 0x7FFFFFF;
+			if (spy->waitRef != 0xFFFFFFFF) {
+				wait = min(wait, (spy->waitRef > m) ? spy->waitRef - m : 0);
+			}
+			if (spy->pingRef != 0xFFFFFFFF) {
+				wait = min(wait, (spy->pingRef > m) ? spy->pingRef - m : 0);
+			}
+		} else {
+			if (polled) {
+				// Accept new clients (the WiFiServer has no event for them)
+				wait = TELNETSPY_TASK_IDLE_TIME;
+			}
+#ifdef TELNETSPY_LOCK_FREE
+			if (spy->bufUsed > 0) {
+				// The writers never drop old data in lock free mode, handle() does
+				wait = min(wait, (uint32_t) TELNETSPY_TASK_POLL_TIME);
+			}
+#endif
+		}
+		if (spy->storage && spy->saveDirty && (spy->saveTime > 0)) {
+			unsigned long t = millis() - spy->saveRef;
+			wait = min(wait, (t < spy->saveTime) ? spy->saveTime - t : 0);
+		}
+		// At least one tick, so the idle task isn't starved
+		ulTaskNotifyTake(pdTRUE, (wait == 0xFFFFFFFF) ? portMAX_DELAY : max(pdMS_TO_TICKS(wait), (TickType_t) 1));
+	}
+	spy->task = NULL;
+	vTaskDelete(NULL);
+}
+
+void TelnetSpy::wakeupTask(void* arg) {
+	// Called by the transport on connects, disconnects and received data
+	((TelnetSpy*) arg)->notifyTask();
+}
+
+void TelnetSpy::notifyTask() {
+	if (xPortInIsrContext()) {
+		vTaskNotifyGiveFromISR(task, NULL);
+	} else {
+		xTaskNotifyGive(task);
+	}
+}
+
+#endif
+
+void TelnetSpy::handleConnection() {
+	for (uint8_t i = 0; i < maxClients; i++) {
+		// The replay budget counts per call of handle()
+		clientReplayLeft[i] = replayBudget ? replayBudget : 0xFFFF;
+	}
 	if (firstMainLoop) {
 		firstMainLoop = false;
     	// Between setup() and loop() the configuration for os_print may be changed so it must be renewed
@@ -714,68 +3916,114 @@ void TelnetSpy::handle() {
 			setDebugOutput(true);
 		}
 	}
+	if (storage && saveDirty && (saveTime > 0) && ((millis() - saveRef) >= saveTime)) {
+		saveRef = millis();
+		saveBuffer();
+	}
+#ifdef TELNETSPY_LOCK_FREE
+	if (telnetBuf && !clientsConnected()) {
+		// The writers never drop old data in lock free mode, so keep some space for them
+		size_t reserve = min((size_t) maxBlockSize, bufLen >> 1);
+		while (bufUsed > bufLen - reserve) {
+			if (!backlogBuf || !compressTelnetBuf()) {
+				evictTelnetLine(TELNETSPY_SEVERITY_ERROR);
+			}
+		}
+	}
+#endif
 	if (!started) {
 		return;
 	}
 	if (!listening) {
-        switch (WiFi.getMode()) {
-            case WIFI_MODE_STA:
-                if (WiFi.status() != WL_CONNECTED) {
-                    return;
-                }
-                break;
-            case WIFI_MODE_AP:
-            case WIFI_MODE_APSTA:
-                break;
-            default:
-                return;
-        }
-		telnetServer = new WiFiServer(port);
-		telnetServer->begin();
-		telnetServer->setNoDelay(bufLen > 0);
+		transport->setNoDelay(bufLen > 0);
+		if (!transport->begin(port)) {
+			// The network isn't ready yet
+			return;
+		}
 		listening = true;
 	}
-    if (telnetServer->hasClient()) {
-        if (client.connected()) {
-            WiFiClient rejectClient = telnetServer->available();
-			if (strlen(rejectMsg) > 0) {
-				rejectClient.write((const uint8_t*) rejectMsg, strlen(rejectMsg));
+    if (transport->hasClient()) {
+		uint8_t slot = 0;
+		while ((slot < maxClients) && (transport->connected(slot) || connected[slot])) {
+			slot++;
+		}
+        if (slot >= maxClients) {
+			// The rejected client gets the extra slot of the transport
+			if (transport->accept(TELNETSPY_MAX_CLIENTS)) {
+				writeMsg(TELNETSPY_MAX_CLIENTS, rejectMsg, rejectMsgFlash);
+				transport->flush(TELNETSPY_MAX_CLIENTS);
+				transport->stop(TELNETSPY_MAX_CLIENTS);
 			}
-			rejectClient.flush();
-            rejectClient.stop();
-        } else {
-            client = telnetServer->available();
-			if (strlen(welcomeMsg) > 0) {
-				client.write((const uint8_t*) welcomeMsg, strlen(welcomeMsg));
+        } else if (transport->accept(slot)) {
+CRITCAL_SECTION_START
+            // The data buffered up to now is replayed (see setReplay)
+            size_t start = replayStart();
+            clientSent[slot] = start;
+            clientStamp[slot] = timestamps ? skipRecords(bufRdIdx, start, bufStamp) : bufStamp;
+            clientStampPos[slot] = 0;
+            clientLive[slot] = bufUsed;
+            clientBacklog[slot] = (replayMode == TELNETSPY_REPLAY_ALL) ? 0 : backlogUsed;
+            clientBacklogPos[slot] = 0;
+            // The end of the replay is marked if it is limited
+            clientReplay[slot] = ((replayMode != TELNETSPY_REPLAY_ALL) || (replayBudget > 0))
+                    && ((start < bufUsed) || (clientBacklog[slot] < backlogUsed));
+            clientReplayMid[slot] = false;
+            clientReplayLeft[slot] = replayBudget ? replayBudget : 0xFFFF;
+            // The live data starts behind the buffered data (if it ends inside
+            // of a line, its rest is sent after the replay)
+            clientLiveSent[slot] = bufUsed;
+            clientLiveStamp[slot] = timestamps ? skipRecords(bufRdIdx, bufUsed, bufStamp) : bufStamp;
+            clientLiveStampPos[slot] = 0;
+            clientLiveMid[slot] = !lineStart;
+CRITCAL_SECTION_END
+            clientDropped[slot] = 0;
+            nvtState[slot] = TELNETSPY_NVT_DATA;
+            endCompression(slot);
+			writeMsg(slot, welcomeMsg, welcomeMsgFlash);
+			if (compression) {
+				// Offer the telnet option COMPRESS2: IAC WILL COMPRESS2
+				const uint8_t offer[] = { 255, 251, 86 };
+				writeClient(slot, offer, sizeof(offer));
 			}
         }
     }
-    if (client.connected()) {
-    	if (!connected) {
-    		connected = true;
-    		if (pingTime != 0) {
-    			pingRef = (millis() & 0x7FFFFFF) + pingTime;
-    		}
-			if (callbackConnect != NULL) {
-				callbackConnect();
+	for (uint8_t i = 0; i < maxClients; i++) {
+	    if (transport->connected(i)) {
+	    	if (!connected[i]) {
+	    		connected[i] = true;
+	    		if ((pingTime != 0) && (pingRef == 0xFFFFFFFF)) {
+	    			pingRef = (millis() & 0x7FFFFFF) + pingTime;
+	    		}
+				stats.connects++;
+				if (callbackConnect != NULL) {
+					callbackConnect();
+				}
 			}
-		}
-	} else {
-    	if (connected) {
-    		connected = false;
-            sendBlock();
-        	client.flush();
-            client.stop();
-			pingRef = 0xFFFFFFFF;
-			waitRef = 0xFFFFFFFF;
-			if (callbackDisconnect != NULL) {
-				callbackDisconnect();
+		} else {
+	    	if (connected[i]) {
+	    		connected[i] = false;
+	        	transport->stop(i);
+	        	resetClient(i);
+	        	if (!isClientConnected()) {
+					pingRef = 0xFFFFFFFF;
+					waitRef = 0xFFFFFFFF;
+	        	}
+				if (callbackDisconnect != NULL) {
+					callbackDisconnect();
+				}
 			}
 		}
 	}
 
-	if (client.connected() && (bufUsed > 0)) {
-		if (bufUsed >= minBlockSize) {
+	for (uint8_t i = 0; i < maxClients; i++) {
+		if (deflate[i] && transport->connected(i)) {
+			// The rest of a compressed write which didn't fit
+			flushCompression(i);
+		}
+	}
+	bool clientConnected = clientsConnected();
+	if (clientConnected && ((bufUsed > 0) || (backlogUsed > 0))) {
+		if ((bufUsed >= minBlockSize) || (backlogUsed > 0)) {
 			sendBlock();
 		} else {
 			unsigned long m = millis() & 0x7FFFFFF;
@@ -791,9 +4039,34 @@ void TelnetSpy::handle() {
 			}
 		}
 	}
-	if (client.connected() && (pingRef != 0xFFFFFFFF)) {
+	if (clientConnected && (pingRef != 0xFFFFFFFF)) {
 		unsigned long m = millis() & 0x7FFFFFF;
 		if (!((pingRef < 0x20000000) && (m > 0x60000000)) && (m >= pingRef)) {
+#ifdef TELNETSPY_LOCK_FREE
+			// Only the writers may add data to the ring buffer, so send the ping directly
+			sendBlock();
+			for (uint8_t i = 0; i < maxClients; i++) {
+				if (!transport->connected(i)) {
+					continue;
+				}
+	            if (nvtDetected) {
+	                // Send a NOP via telnet NVT protocol
+				    const uint8_t nop[] = { 255, 241 };
+				    writeClient(i, nop, sizeof(nop));
+	            } else  {
+	                // Send a NULL
+				    const uint8_t nul = 0;
+				    writeClient(i, &nul, 1);
+	            }
+			}
+			pingRef = m + pingTime;
+			if (pingRef > 0x7FFFFFFF) {
+				pingRef -= 0x80000000;
+			}
+#else
+			while ((bufUsed > 0) && (bufLen - bufUsed < 2)) {
+				dropTelnetLine();
+			}
             if (nvtDetected) {
                 // Send a NOP via telnet NVT protocol
 			    addTelnetBuf(255);
@@ -803,15 +4076,17 @@ void TelnetSpy::handle() {
 			    addTelnetBuf(0);
             }
 			sendBlock();
+#endif
 		}
 	}
-    if (client.connected()) {
+    if (clientConnected) {
         checkReceive();
     }
 }
 
 void TelnetSpy::writeRecBuf(char c) {
     if (recLen == recUsed) {
+        stats.recOverflows++;
         return;
     }
 CRITCAL_SECTION_START
@@ -823,130 +4098,209 @@ CRITCAL_SECTION_START
 CRITCAL_SECTION_END
 }
 
+void TelnetSpy::writeRecBuf(const char* data, uint16_t len) {
+CRITCAL_SECTION_START
+	size_t space = recLen - recUsed;
+	if (len > space) {
+		stats.recOverflows += len - space;
+		len = space;
+	}
+	uint16_t tmp = min((size_t) len, recLen - recWrIdx);
+	memcpy(&recBuf[recWrIdx], data, tmp);
+	memcpy(recBuf, &data[tmp], len - tmp);
+	recWrIdx += len;
+	if (recWrIdx >= recLen) {
+		recWrIdx -= recLen;
+	}
+	recUsed += len;
+CRITCAL_SECTION_END
+}
+
 void TelnetSpy::checkReceive() {
-	int n = client.available();
+	lockClients();
+	for (uint8_t i = 0; i < maxClients; i++) {
+		if (transport->connected(i)) {
+			checkReceive(i);
+		}
+	}
+	unlockClients();
+}
+
+void TelnetSpy::checkReceive(uint8_t slot) {
+	// The data is read in chunks and parsed byte by byte by a state machine,
+	// so a telegram may be split anywhere. The plain data runs are copied
+	// into the receive buffer at once.
+	uint8_t buf[TELNETSPY_REC_CHUNK_LEN];
+	uint16_t filter = filterChar ? (uint8_t) filterChar : 0x100;
+	int n = transport->available(slot);
 	while (n > 0) {
-        char c, c2;
-        c = client.peek();
-        if (filterChar && (filterChar == c)) {
-            // Filter character detected
-			if (strlen(filterMsg) > 0) {
-				client.write((const uint8_t*) filterMsg, strlen(filterMsg));
-			}
-   			client.read();  // Remove filter character
-            n--;
-            if (filterCallback != NULL) {
-                filterCallback();
+		uint16_t len = 1;
+		if (recBuf) {
+			int tmp = transport->read(slot, buf, min(n, (int) sizeof(buf)));
+			if (tmp <= 0) {
+				return;
+			}
+			len = tmp;
+		} else {
+			// Without receive buffer the data stays in the client buffer, so
+			// only filter characters and telegrams in front of it are read
+			if (nvtState[slot] == TELNETSPY_NVT_DATA) {
+				int c = transport->peek(slot);
+				if ((c != 255) && (c != filter)) {
+					return;
+				}
+			}
+			if (transport->read(slot, buf, 1) != 1) {
+				return;
+			}
+		}
+		n -= len;
+		uint16_t i = 0;
+		while (i < len) {
+			uint8_t c = buf[i++];
+			switch (nvtState[slot]) {
+				case TELNETSPY_NVT_DATA:
+					if (c == filter) {
+						// Filter character detected
+						writeMsg(slot, filterMsg, filterMsgFlash);
+						if (filterCallback != NULL) {
+							filterCallback();
+						}
+					} else if (c == 255) {
+						// IAC (start of telnet NVT protocol telegram)
+						nvtState[slot] = TELNETSPY_NVT_IAC;
+					} else {
+						uint16_t start = i - 1;
+						while ((i < len) && (buf[i] != 255) && (buf[i] != filter)) {
+							i++;
+						}
+						writeRecBuf((const char*) &buf[start], i - start);
+					}
+					break;
+				case TELNETSPY_NVT_IAC:
+					if ((c >= 251) && (c <= 254)) {
+						// WILL, WON'T, DO or DON'T: the option byte follows
+						nvtCmd[slot] = c;
+						nvtState[slot] = TELNETSPY_NVT_OPTION;
+					} else if (c == 250) {
+						// Telnet command "SB" (additional data follows up to IAC SE)
+						nvtState[slot] = TELNETSPY_NVT_SB;
+					} else {
+						nvtState[slot] = TELNETSPY_NVT_DATA;
+						nvtCommand(slot, c, 0);
+						if (!transport->connected(slot)) {
+							return;
+						}
+					}
+					break;
+				case TELNETSPY_NVT_OPTION:
+					nvtState[slot] = TELNETSPY_NVT_DATA;
+					nvtCommand(slot, nvtCmd[slot], c);
+					if (!transport->connected(slot)) {
+						return;
+					}
+					break;
+				case TELNETSPY_NVT_SB:
+					// The additional data is ignored
+					if (c == 255) {
+						nvtState[slot] = TELNETSPY_NVT_SB_IAC;
+					} else {
+						uint8_t* p = (uint8_t*) memchr(&buf[i], 255, len - i);
+						i = p ? p - buf : len;
+					}
+					break;
+				case TELNETSPY_NVT_SB_IAC:
+					// IAC SE ends the additional data, IAC IAC is an escaped 0xff
+					nvtState[slot] = (c == 240) ? TELNETSPY_NVT_DATA : TELNETSPY_NVT_SB;
+					break;
+			}
+		}
+	}
+}
+
+void TelnetSpy::nvtCommand(uint8_t slot, uint8_t command, uint8_t option) {
+    switch (command) {
+        case 241:   // Telnet command "NOP" (no operation)
+            if (pingTime != 0) {
+                pingRef = (millis() & 0x7FFFFFF) + pingTime;
             }
-            continue;
-        }
-		if (255 == c) {  // If IAC (start of telnet NVT protocol telegram):
-            if (n == 1) {
-                // Telegram incomplete
-                return;
+            break;
+        case 242:   // Telnet command "Data Mark" (not yet implemented)
+            break;
+        case 243:   // Telnet command "Break";
+            if (callbackNvtBRK != NULL) {
+                callbackNvtBRK();
             }
-   			client.read();  // Remove IAC
-            n--;
-            c = client.read();  // Gett command byte
-            n--;
-            switch (c) {
-                case 241:   // Telnet command "NOP" (no operation)
-              		if (pingTime != 0) {
-  		            	pingRef = (millis() & 0x7FFFFFF) + pingTime;
-  		            }
-                    break;
-                case 242:   // Telnet command "Data Mark" (not yet implemented)
-                    break;
-                case 243:   // Telnet command "Break";
-                    if (callbackNvtBRK != NULL) {
-                        callbackNvtBRK();
-                    }
-                    break;
-                case 244:   // Telnet command "Interrupt process"
-                    if (callbackNvtIP != NULL) {
-                        if ((void(*)()) 1 == callbackNvtIP) {
-                            ESP.restart();
-                        } else {
-                            callbackNvtIP();
-                        }
-                    }
-                    break;
-                case 245:   // Telnet command "Abort output"
-                    if (callbackNvtAO != NULL) {
-                        if ((void(*)()) 1 == callbackNvtAO) {
-                            disconnectClient();
-                        } else {
-                            callbackNvtAO();
-                        }
-                    }
-                    break;
-                case 246:   // Telnet command "Are you there"
-                    if (callbackNvtAYT != NULL) {
-                        callbackNvtAYT();
-                    }
-                    break;
-                case 247:   // Telnet command "Erase character"
-                    if (callbackNvtEC != NULL) {
-                        callbackNvtEC();
-                    }
-                    break;
-                case 248:   // Telnet command "Erase line"
-                    if (callbackNvtEL != NULL) {
-                        callbackNvtEL();
-                    }
-                    break;
-                case 249:   // Telnet command "Go ahead"
-                    if (callbackNvtGA != NULL) {
-                        callbackNvtGA();
-                    }
-                    break;
-                case 250:   // Telnet command "SB" (additional data follows)
-                    while (n > 0) {
-                        c = client.read();
-                        n--;
-                        if (255 != c) {
-                            // If not IAC, ignore it
-                            continue;
-                        }
-                        c = client.read();
-                        n--;
-                        if (240 != c) {
-                            // If not SE (end of additional data), ignore it
-                            continue;
-                        }
-                    }
-                    break;
-                case 251:   // Telnet command "WILL"
-                case 252:   // Telnet command "WON'T"
-                case 253:   // Telnet command "DO"
-                case 254:   // Telnet command "DON'T"
-                    nvtDetected = true;
-                    c2 = client.read();     // Get option byte
-                    n--;
-                    if (callbackNvtWWDD != NULL) {
-                        callbackNvtWWDD(c, c2);
-                    }
-                    break;
-                case 255:   // Escaped data byte 0xff
-                    if (recBuf) {
-                        writeRecBuf(c);
-                    } else {
-                        // If no receive buffer is used, the data byte 0xff will be lost.
-                        // May be in the future there is a solution for this problem.
-                    }
-                    break;
+            break;
+        case 244:   // Telnet command "Interrupt process"
+            if (callbackNvtIP != NULL) {
+                if ((void(*)()) 1 == callbackNvtIP) {
+                    saveBuffer();
+                    ESP.restart();
+                } else {
+                    callbackNvtIP();
+                }
             }
-            continue;
-		}
-        // Next character in the client buffer is a normal character
-        if (recBuf) {
-            client.read();
-            writeRecBuf(c);
-            n--;
-            continue;
-        }
-        // Leave the character in the client buffer
-        return;
-	}
+            break;
+        case 245:   // Telnet command "Abort output"
+            if (callbackNvtAO != NULL) {
+                if ((void(*)()) 1 == callbackNvtAO) {
+                    disconnectClient(slot);
+                } else {
+                    callbackNvtAO();
+                }
+            }
+            break;
+        case 246:   // Telnet command "Are you there"
+            if (callbackNvtAYT != NULL) {
+                callbackNvtAYT();
+            }
+            break;
+        case 247:   // Telnet command "Erase character"
+            if (callbackNvtEC != NULL) {
+                callbackNvtEC();
+            }
+            break;
+        case 248:   // Telnet command "Erase line"
+            if (callbackNvtEL != NULL) {
+                callbackNvtEL();
+            }
+            break;
+        case 249:   // Telnet command "Go ahead"
+            if (callbackNvtGA != NULL) {
+                callbackNvtGA();
+            }
+            break;
+        case 251:   // Telnet command "WILL"
+        case 252:   // Telnet command "WON'T"
+        case 253:   // Telnet command "DO"
+        case 254:   // Telnet command "DON'T"
+            nvtDetected = true;
+            if ((253 == command) && (86 == option) && compression && !deflate[slot]) {
+                // The client accepts COMPRESS2: the stream starts with the next
+                // data sent to the client (see writeClient)
+                TelnetSpyDeflate* z = (TelnetSpyDeflate*) malloc(sizeof(TelnetSpyDeflate));
+                if (z) {
+                    memset(z, 0, sizeof(TelnetSpyDeflate));
+                    z->adler = 1;
+                    deflate[slot] = z;
+                }
+            } else if ((254 == command) && (86 == option)) {
+                // The client wants to end the compression
+                endCompression(slot, true);
+            }
+            if (callbackNvtWWDD != NULL) {
+                callbackNvtWWDD(command, option);
+            }
+            break;
+        case 255:   // Escaped data byte 0xff
+            if (recBuf) {
+                writeRecBuf(command);
+            } else {
+                // If no receive buffer is used, the data byte 0xff will be lost.
+                // May be in the future there is a solution for this problem.
+            }
+            break;
+    }
 }
 
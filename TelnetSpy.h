@@ -3,7 +3,7 @@
  * Cloning the serial port via Telnet.
  *
  * Written by Wolfgang Mattis (arduino@wm0.eu).
- * Version 1.4 / June 25, 2022.
+ * Version 1.5 / October 16, 2026.
  * MIT license, all text above must be included in any redistribution.   
  */
 
@@ -30,6 +30,12 @@
  *		#include <TelnetSpy.h>
  *		TelnetSpy LOG;
  *
+ * Or without heap for the buffers: static arrays (see setBuffer and
+ * setRecBuffer):
+ *		static char logBuf[4096];
+ *		static char logRecBuf[64];
+ *		TelnetSpy LOG(logBuf, sizeof(logBuf), logRecBuf, sizeof(logRecBuf));
+ *
  * Add the following line to your initialisation block ( void setup() ):
  *		LOG.begin();
  *
@@ -48,12 +54,15 @@
  * Default: "Connection established via TelnetSpy.\n"
  *		void setWelcomeMsg(const char* msg);
  *		void setWelcomeMsg(const String& msg);
+ *		void setWelcomeMsg(const __FlashStringHelper* msg);
+ * A message given by F("...") stays in flash, it is not copied to the heap.
  *
- * Change the message which will be send to the telnet client if another
- * session is already established.
+ * Change the message which will be send to the telnet client if all
+ * sessions (see setMaxClients) are already established.
  * Default: "TelnetSpy: Only one connection possible.\n"
  *		void setRejectMsg(const char* msg);
  *		void setRejectMsg(const String& msg);
+ *		void setRejectMsg(const __FlashStringHelper* msg);
  *
  * Change the amount of characters to collect before sending a telnet block.
  * Default: 64 
@@ -73,12 +82,28 @@
  * cannot be send via telnet, it will be send to serial output only.
  * Changing size tries to preserve the already collected data. If the new
  * buffer size is too small the youngest data will be preserved only. Returns
- * false if the requested buffer size cannot be set.
+ * false if the requested buffer size cannot be set (see also
+ * setExternalRam).
  * Default: 3000
- *		bool setBufferSize(uint16_t newSize);
+ *		bool setBufferSize(size_t newSize);
  *
  * This function returns the actual size of the transmit buffer.
- *		uint16_t getBufferSize();
+ *		size_t getBufferSize();
+ *
+ * Use the given memory as transmit buffer (NULL: "size" bytes of the heap),
+ * setBufferSize can't exceed it. Returns false if "size" is less than
+ * "minSize" (see setMinBlockSize).
+ *		bool setBuffer(char* buffer, size_t size);
+ *
+ * Place the transmit buffer and the compressed backlog (see setBacklogSize)
+ * in the external RAM (PSRAM) of an ESP32. If there is no (or not enough)
+ * external RAM, the internal heap is used. Already allocated buffers are
+ * moved. It has no effect on ESP8266.
+ * Default: TELNETSPY_EXTERNAL_RAM (false)
+ *		void setExternalRam(bool external);
+ *
+ * This function returns true, if the buffers are placed in external RAM.
+ *		bool getExternalRam();
  *
  * Enable / disable storing new data in the transmit buffer if no telnet
  * connection is established. This function allows you to store important data
@@ -108,19 +133,299 @@
  * will not work. If no receive buffer is used, you cannot receive the code
  * 0xff (it will be lost because of a limitation of the WiFiAPI).
  * Default: 64
- *		bool setRecBufferSize(uint16_t newSize);
+ *		bool setRecBufferSize(size_t newSize);
  *
  * This function returns the actual size of the receive buffer.
- *		uint16_t getRecBufferSize();
+ *		size_t getRecBufferSize();
+ *
+ * Use the given memory as receive buffer (NULL: "size" bytes of the heap),
+ * setRecBufferSize can't exceed it. The received data is lost.
+ *		bool setRecBuffer(char* buffer, size_t size);
  *
  * Set the serial port you want to use with this object (especially for ESP32)
  * or NULL if no serial port should be used (telnet only).
  * Default: Serial
  *		void setSerial(HardwareSerial* usedSerial);
  *
+ * Change the size of the serial queue. Set it to 0 to write to the serial
+ * port directly (the writing waits if the UART is busy). With a queue the
+ * data which the UART cannot take at once is queued and sent by handle(), so
+ * writing never waits for the serial port. If the queue is full, the new
+ * data is not sent to the serial port (counted as "serialDropped", see
+ * getStats). The telnet side is not affected by this. The output of os_print
+ * (see setDebugOutput) is not queued. Changing the size sends the queued data
+ * first. Returns false if the requested size cannot be set.
+ * Default: TELNETSPY_SERIAL_QUEUE_LEN (0)
+ *		bool setSerialQueueSize(uint16_t newSize);
+ *
+ * This function returns the actual size of the serial queue.
+ *		uint16_t getSerialQueueSize();
+ *
  * This function returns true, if a telnet client is connected.
  *		bool isClientConnected();
  *
+ * Change the number of telnet clients which can be connected at the same
+ * time (1 ... TELNETSPY_MAX_CLIENTS). All clients get the same data out of
+ * the one transmit buffer, each client has its own read position in it.
+ * Data is removed from the buffer when it is sent to all connected clients.
+ * If the buffer is full, the oldest data is dropped even if a slow client has
+ * not got it yet (see getDroppedCount). Data received from all clients is
+ * handled as data received by serial port. Clients exceeding this number are
+ * rejected (see setRejectMsg).
+ * Default: 1
+ *		void setMaxClients(uint8_t maxCount);
+ *
+ * This function returns the number of telnet clients which can be connected
+ * at the same time.
+ *		uint8_t getMaxClients();
+ *
+ * This function returns the number of connected telnet clients.
+ *		uint8_t getClientCount();
+ *
+ * This function returns the amount of data which was dropped from the
+ * transmit buffer before it could be sent to the client in the given slot
+ * (0 ... getMaxClients() - 1) since it has connected.
+ *		uint32_t getDroppedCount(uint8_t slot);
+ *
+ * This function returns a snapshot of the statistics counters of this object
+ * (see struct TelnetSpyStats below), i.e. to tune the buffer and block sizes.
+ *		TelnetSpyStats getStats();
+ *
+ * This function sets all statistics counters to 0 (the peak fill level of the
+ * transmit buffer to the actual fill level).
+ *		void resetStats();
+ *
+ * Enable / disable a timestamp "[hh:mm:ss.mmm] " (time since start) in front
+ * of every line sent via telnet. The time is stored in a compact binary form
+ * when the line is written and converted to text when it is sent, so lines
+ * collected while offline get the time when they were written and the
+ * buffer holds more lines than with formatted timestamps. The serial output
+ * is not changed. Changing this setting clears the transmit buffer. No
+ * timestamps are added if the transmit buffer is disabled.
+ * Default: false
+ *		void setTimestamps(bool enable);
+ *
+ * This function returns true, if timestamps are enabled.
+ *		bool getTimestamps();
+ *
+ * Set the severity of the data written after this call (one of
+ * TELNETSPY_SEVERITY_DEBUG, TELNETSPY_SEVERITY_INFO, TELNETSPY_SEVERITY_WARNING
+ * or TELNETSPY_SEVERITY_ERROR). A line gets the severity which is set when its
+ * first character is written. This includes the os_print calls (see
+ * setDebugOutput).
+ * Default: TELNETSPY_SEVERITY_INFO
+ *		void setSeverity(uint8_t level);
+ *
+ * This function returns the severity of the data written now.
+ *		uint8_t getSeverity();
+ *
+ * Data written with a severity less than "level" is not stored in the
+ * transmit buffer (it is still sent to the serial port).
+ * Default: TELNETSPY_SEVERITY_DEBUG
+ *		void setSeverityThreshold(uint8_t level);
+ *
+ * This function returns the actual severity threshold.
+ *		uint8_t getSeverityThreshold();
+ *
+ * Enable / disable the priority aware eviction. If the transmit buffer is full,
+ * the oldest line of the lowest severity is removed instead of the oldest line.
+ * If all lines in the buffer have a higher severity than the new data, the new
+ * data is not stored (up to the end of its line). So i.e. errors written before
+ * a telnet session is established survive a flood of debug output. Lines which
+ * are already partially sent to a client are not removed out of order. The
+ * severity is stored together with every line (2 bytes, or with the
+ * timestamp, see setTimestamps). Changing this setting clears the transmit
+ * buffer. It has no effect if the transmit buffer is disabled.
+ * Default: false
+ *		void setPriorityEviction(bool enable);
+ *
+ * This function returns true, if the priority aware eviction is enabled.
+ *		bool getPriorityEviction();
+ *
+ * Change what happens if new data doesn't fit into the full transmit buffer
+ * (after one attempt to send buffered data to the connected clients):
+ *		TELNETSPY_OVERFLOW_DROP_OLDEST	the oldest lines are removed
+ *		TELNETSPY_OVERFLOW_DROP_NEWEST	the new data is not stored (up to the
+ *										end of its line)
+ *		TELNETSPY_OVERFLOW_BLOCK		the writing waits up to "value" ms
+ *										(default TELNETSPY_OVERFLOW_TIMEOUT)
+ *										until the clients took enough data,
+ *										then the oldest lines are removed
+ *		TELNETSPY_OVERFLOW_SAMPLE		only every "value"th new line
+ *										(default TELNETSPY_OVERFLOW_SAMPLING)
+ *										is stored, the oldest lines are
+ *										removed for it
+ * A line which is already partially stored is always completed by removing
+ * the oldest lines. TELNETSPY_OVERFLOW_BLOCK behaves like
+ * TELNETSPY_OVERFLOW_DROP_OLDEST while no client is connected, after a
+ * timeout until the clients take data again, for os_print (see
+ * setDebugOutput), in interrupts, in the callbacks of handle() and on the
+ * ESP8266 in the callbacks of the network stack. On the ESP32 don't use it if
+ * TelnetSpy is written in callbacks of the network stack. The outcomes are
+ * counted in the statistics (see getStats). With TELNETSPY_LOCK_FREE the new
+ * data is always dropped.
+ * Default: TELNETSPY_OVERFLOW (TELNETSPY_OVERFLOW_DROP_OLDEST)
+ *		void setOverflowPolicy(uint8_t policy, uint16_t value = 0);
+ *
+ * This function returns the overflow policy (see setOverflowPolicy).
+ *		uint8_t getOverflowPolicy();
+ *
+ * Change the size of the compressed backlog. Set it to 0 to disable it. If the
+ * transmit buffer is full while no client is connected, its oldest complete
+ * lines are compressed in blocks (of up to TELNETSPY_BACKLOG_BLOCK_LEN bytes)
+ * and moved into the backlog instead of being dropped. If the backlog is full,
+ * its oldest block is dropped. When a client connects, it gets the backlog
+ * before the data of the transmit buffer. Log text is typically compressed to
+ * 55 ... 65 %, so a big backlog together with a smaller transmit buffer keeps
+ * more history in the same amount of RAM (the backlog needs a scratch buffer
+ * of 2 * TELNETSPY_BACKLOG_BLOCK_LEN + 512 bytes in addition). Changing the
+ * size clears the backlog. Returns false if the requested size cannot be set.
+ * Default: 0
+ *		bool setBacklogSize(uint16_t newSize);
+ *
+ * This function returns the actual size of the compressed backlog.
+ *		uint16_t getBacklogSize();
+ *
+ * Enable or disable the compression of the data sent to the telnet clients.
+ * If enabled, the telnet option COMPRESS2 (86, "MCCP2") is offered to every
+ * new client. If the client accepts it, all following data is sent as a
+ * deflate stream (with a window of TELNETSPY_COMPRESSION_WINDOW bytes, which
+ * needs about 1.8 kB per compressing client). Clients which don't know the
+ * option refuse it and get uncompressed data, but clients which don't
+ * support the telnet protocol at all (i.e. netcat) get the 3 bytes of the
+ * offer as garbage. A client can end the compression at any time (DON'T
+ * COMPRESS2). Log text is typically sent with 40 ... 60 % of its size.
+ * Default: false
+ *		void setCompression(bool enable);
+ *
+ * This function returns true, if the compression is offered to new clients.
+ *		bool getCompression();
+ *
+ * ESP32 only: let TelnetSpy run in its own task (pinned to "core"), so the
+ * telnet output doesn't depend on the calls of handle() in your main loop
+ * (calls of handle() by other tasks are ignored while the task runs). The
+ * task sleeps until write() signals the first byte of a block or a full
+ * block (see setMinBlockSize), until the collecting time or the ping time
+ * is over. A transport which must be polled (TelnetSpyWiFiTransport) wakes
+ * it every TELNETSPY_TASK_POLL_TIME ms while clients are connected (to
+ * receive data) and every TELNETSPY_TASK_IDLE_TIME ms otherwise (to accept
+ * new clients), the other transports wake it on their events only. The task
+ * mode needs the transmit buffer and the receive buffer (setBufferSize /
+ * setRecBufferSize must not be 0), returns false if the task cannot be
+ * started.
+ * Defaults: TELNETSPY_TASK_CORE (0), TELNETSPY_TASK_PRIORITY (1),
+ * TELNETSPY_TASK_STACK (4096)
+ *		bool startTask(uint8_t core, uint8_t priority, uint32_t stackSize);
+ *
+ * ESP32 only: stop the task started by startTask, afterwards handle() must
+ * be called by your main loop again.
+ *		void stopTask();
+ *
+ * Change the network transport of the telnet clients. The connected clients
+ * are disconnected, the new transport starts listening with the next call of
+ * handle(). Use NULL to return to the default. Available transports:
+ *		TelnetSpyWiFiTransport
+ *			WiFiServer and WiFiClient, polled by handle() (default).
+ *		TelnetSpyAsyncTransport
+ *			AsyncServer and AsyncClient of the libraries AsyncTCP (ESP32) or
+ *			ESPAsyncTCP (ESP8266), define TELNETSPY_ASYNC_TCP before the
+ *			include of TelnetSpy.h to use it. Connects and received data are
+ *			delivered by callbacks (up to TELNETSPY_TRANSPORT_REC_LEN bytes
+ *			per client until handle() fetches them) and the data is sent
+ *			without blocking, as much as fits into the TCP send buffer.
+ *		TelnetSpyLoopbackTransport(size_t window = 0);
+ *			Clients in memory for tests and benchmarks: connectClient(),
+ *			disconnectClient(slot), input(slot, data, len) and
+ *			output(slot, data, len) play the clients, getSent(slot) counts
+ *			the sent bytes. At most "window" bytes are kept per client until
+ *			output() removes them (0 = take and drop everything).
+ *		TelnetSpySyslogTransport(IPAddress server, uint16_t port = 514, const char* hostname = NULL, const char* appName = "TelnetSpy");
+ *			Sends the lines as RFC 5424 syslog messages (facility local0,
+ *			the severity of the line, see setSeverity) in UDP datagrams to
+ *			a syslog server instead of serving telnet clients. Every line
+ *			is sent in its own datagram (split if it is longer than
+ *			TELNETSPY_SYSLOG_MTU bytes, see setMtu) and at most
+ *			TELNETSPY_SYSLOG_RATE datagrams per second are sent
+ *			(setRateLimit, 0 = unlimited), the other data waits in the
+ *			transmit buffer. The severity is stored with every buffered
+ *			line, so setting this transport clears the transmit buffer.
+ *			The collecting time, the block sizes and setStoreOffline work
+ *			as for a telnet client (the "client" is connected while the
+ *			network is up). A line is sent when it is complete (or by
+ *			flush()). The hostname is the own IP address if it is NULL,
+ *			the timestamp is set if the time is synchronized (i.e. by
+ *			configTime). The welcome message is sent as a line each time
+ *			the network comes up, use setWelcomeMsg("") to suppress it.
+ * Derive your own class from TelnetSpyTransport for other networks. The
+ * transport must exist as long as it is set: TelnetSpy stops it on its
+ * destruction, so declare it before the TelnetSpy object.
+ * Default: NULL (TelnetSpyWiFiTransport)
+ *		void setTransport(TelnetSpyTransport* newTransport);
+ *
+ * Change which part of the transmit buffer a new client gets before the
+ * live data ("replay"):
+ *		TELNETSPY_REPLAY_ALL	the whole buffer and the compressed backlog
+ *		TELNETSPY_REPLAY_NONE	nothing
+ *		TELNETSPY_REPLAY_LINES	the last "value" lines
+ *		TELNETSPY_REPLAY_SINCE	the lines written since millis() was "value"
+ *								(needs setTimestamps(true), otherwise the
+ *								whole buffer is replayed)
+ * The compressed backlog is replayed by TELNETSPY_REPLAY_ALL only. If the
+ * replay is limited (by the mode or by setReplayBudget), the new lines are
+ * sent in between the replayed lines and TELNETSPY_LIVE_MSG marks the end of
+ * the replay.
+ * Default: TELNETSPY_REPLAY (TELNETSPY_REPLAY_ALL)
+ *		void setReplay(uint8_t mode, uint32_t value = 0);
+ *
+ * This function returns the replay mode (see setReplay).
+ *		uint8_t getReplay();
+ *
+ * Limit the replayed data (see setReplay) sent to a client per call of
+ * handle() to "bytes", so a large replay doesn't block the main loop and the
+ * network after a connect. The new lines are sent first in every call, so
+ * they are not delayed by the replay. The other clients get their data as
+ * usual. Use 0 for no limit (the replay is sent in blocks of
+ * setMaxBlockSize).
+ * Default: TELNETSPY_REPLAY_BUDGET (0)
+ *		void setReplayBudget(uint16_t bytes);
+ *
+ * This function returns the limit of the replayed data per call of handle().
+ *		uint16_t getReplayBudget();
+ *
+ * Use a storage to keep the youngest lines of the transmit buffer over a
+ * restart (i.e. by a crash, the watchdog or the telnet command "Interrupt
+ * Process"). Call it early in setup(): if the storage contains valid data of
+ * the last run, this data is put in front of the transmit buffer (followed by
+ * TELNETSPY_RESTART_MSG) and true is returned. The oldest lines of the
+ * buffer are dropped to make room for the message; false is returned if the
+ * buffer is too small for it. The data is validated by a magic value and a
+ * checksum. Use NULL to stop saving. Available storages:
+ *		TelnetSpyRtcStorage(uint16_t offset = 0, uint16_t size = TELNETSPY_RTC_STORAGE_LEN);
+ *			RTC user memory on ESP8266 (up to 512 bytes, offset and size must
+ *			be multiples of 4), RTC_NOINIT memory on ESP32
+ *			(TELNETSPY_RTC_STORAGE_LEN bytes). Its content survives all
+ *			restarts except power on.
+ *		TelnetSpyFileStorage(fs::FS& fileSystem, const char* fileName, uint16_t size);
+ *			A file of a file system (i.e. LittleFS). Increase the save time
+ *			(see setSaveTime) to limit the flash wear.
+ * Derive your own class from TelnetSpyStorage for other memories.
+ * Default: NULL
+ *		bool setStorage(TelnetSpyStorage* newStorage);
+ *
+ * Change the time (in ms) between two saves of the transmit buffer to the
+ * storage (see setStorage). The buffer is saved only if new data was written.
+ * Data written after the last save is lost by a crash. Use 0 to save only by
+ * saveBuffer (and before the restart by the telnet command "Interrupt
+ * Process").
+ * Default: TELNETSPY_SAVE_TIME
+ *		void setSaveTime(uint16_t time);
+ *
+ * Save the youngest lines of the transmit buffer to the storage (see
+ * setStorage) now, i.e. before you call ESP.restart() yourself. Returns false
+ * if there is no storage, it reports an error or the buffer was changed during
+ * all TELNETSPY_SAVE_TRIES copies (then it is saved again after the save time).
+ *		bool saveBuffer();
+ *
  * This function installs a callback function which will be called on every
  * telnet connect of this object (except rejected connect tries). Use NULL to
  * remove the callback.
@@ -133,8 +438,10 @@
  * Default: NULL
  *		void setCallbackOnDisconnect(void (*callback)());
  *
- * This function disconnects an active client connection.
+ * This function disconnects all active client connections or the one in the
+ * given slot (0 ... getMaxClients() - 1) only.
  *      void disconnectClient();
+ *      void disconnectClient(uint8_t slot);
  *
  * This function clears the transmit buffer of TelnetSpy, so all waiting data
  * to send via a telnet connection will be discard.
@@ -148,6 +455,7 @@
  *  - If the "callback" is set (not NULL), the given function is called.
  *      void setFilter(char ch, const char* msg, void (*callback());
  *      void setFilter(char ch, const String& msg, void (*callback());
+ *      void setFilter(char ch, const __FlashStringHelper* msg, void (*callback());
  *
  * This function returns the actual filter character (0 => not set).
  *      char getFilter();
@@ -164,13 +472,15 @@
  * This function installs a callback function which will be called whenever
  * the telnet command "IP" (Interrupt Process) is received. Use NULL to remove
  * the callback.
- * Default: 1 (=> ESP.restart will be called)
+ * Default: 1 (=> the transmit buffer is saved (see setStorage) and ESP.restart
+ * will be called)
  *		void setCallbackOnNvtIP)(void (*callback)());
  *
  * This function installs a callback function which will be called whenever
  * the telnet command "AO" (Abort Output) is received. Use NULL to remove the
  * callback.
- * Default: 1 (=> disconnectClient of TelnerSpy will be called)
+ * Default: 1 (=> disconnectClient of TelnerSpy will be called for the client
+ * which has sent the command)
  *		void setCallbackOnNvtAO)(void (*callback)());
  *
  * This function installs a callback function which will be called whenever
@@ -223,14 +533,29 @@
  *
  * All you do with "Serial" you can also do with "TelnetSpy", but remember:
  * Transfering data also via telnet will need more performance than the serial
- * port only. So time critical things may be influenced.
+ * port only. So time critical things may be influenced. To read more than
+ * one character use "read(uint8_t* buffer, size_t len)" (returns all data
+ * available now) or "readBytes", they copy the received data at once.
  *
- * It is not possible to establish more than one telnet connection at the same
- * time. But its possible to use more than one instance of TelnetSpy.
+ * On default it is not possible to establish more than one telnet connection
+ * at the same time (see setMaxClients). But its possible to use more than one
+ * instance of TelnetSpy.
  *
  * If you have problems with low memory you may reduce the value of the define
  * TELNETSPY_BUFFER_LEN for a smaller ring buffer on initialisation.    
  *
+ * On ESP32 the buffers are protected by a spinlock, which disables the
+ * interrupts and lets both cores wait for each other if you write from one
+ * core while handle() runs on the other one. Add TELNETSPY_LOCK_FREE to the
+ * defines of your build (i.e. "-DTELNETSPY_LOCK_FREE") to use lock free ring
+ * buffers instead. In this mode there must be only one task writing to
+ * TelnetSpy and only one task calling handle() and the reading functions. So
+ * disable the capturing of os_print calls (see setDebugOutput) unless they
+ * are done by the writing task only. The writers never drop old data in this
+ * mode: if the buffer is full, the new data is lost. Instead handle() keeps
+ * some space free (up to "maxSize" of setMaxBlockSize) by removing the
+ * oldest lines (see setPriorityEviction) while no client is connected.
+ *
  * Usage of void setDebugOutput(bool) to enable / disable of capturing of
  * os_print calls when you have more than one TelnetSpy instance: That
  * TelnetSpy object will handle this functionallity where you used
@@ -243,6 +568,7 @@
 #define TelnetSpy_h
 
 #define TELNETSPY_BUFFER_LEN 3000
+#define TELNETSPY_EXTERNAL_RAM false
 #define TELNETSPY_MIN_BLOCK_SIZE 64
 #define TELNETSPY_COLLECTING_TIME 100
 #define TELNETSPY_MAX_BLOCK_SIZE 512
@@ -252,6 +578,64 @@
 #define TELNETSPY_WELCOME_MSG "Connection established via TelnetSpy.\r\n"
 #define TELNETSPY_REJECT_MSG "TelnetSpy: Only one connection possible.\r\n"
 #define TELNETSPY_REC_BUFFER_LEN 64
+#define TELNETSPY_REC_CHUNK_LEN 64
+#define TELNETSPY_SERIAL_QUEUE_LEN 0
+#define TELNETSPY_MAX_CLIENTS 3
+#define TELNETSPY_CLIENTS 1
+#define TELNETSPY_STATS_BLOCK_CLASSES 5
+#define TELNETSPY_RECORD_MARK 0x1E
+#define TELNETSPY_RECORD_HEADER_LEN 7
+#define TELNETSPY_SEVERITY_DEBUG 0
+#define TELNETSPY_SEVERITY_INFO 1
+#define TELNETSPY_SEVERITY_WARNING 2
+#define TELNETSPY_SEVERITY_ERROR 3
+#define TELNETSPY_WRITE_SEVERITY TELNETSPY_SEVERITY_INFO
+#define TELNETSPY_SEVERITY_THRESHOLD TELNETSPY_SEVERITY_DEBUG
+#define TELNETSPY_OVERFLOW_DROP_OLDEST 0
+#define TELNETSPY_OVERFLOW_DROP_NEWEST 1
+#define TELNETSPY_OVERFLOW_BLOCK 2
+#define TELNETSPY_OVERFLOW_SAMPLE 3
+#define TELNETSPY_OVERFLOW TELNETSPY_OVERFLOW_DROP_OLDEST
+#define TELNETSPY_OVERFLOW_TIMEOUT 100
+#define TELNETSPY_OVERFLOW_SAMPLING 10
+#define TELNETSPY_BACKLOG_LEN 0
+#define TELNETSPY_BACKLOG_BLOCK_LEN 512
+#define TELNETSPY_BACKLOG_HASH_BITS 8
+#define TELNETSPY_BACKLOG_HEADER_LEN 8
+#define TELNETSPY_COMPRESSION false
+#define TELNETSPY_COMPRESSION_WINDOW 1024
+#define TELNETSPY_COMPRESSION_HASH_BITS 8
+#define TELNETSPY_COMPRESSION_CHUNK 128
+#define TELNETSPY_SAVE_TIME 1000
+#define TELNETSPY_SAVE_TRIES 3
+#define TELNETSPY_REPLAY_ALL 0
+#define TELNETSPY_REPLAY_NONE 1
+#define TELNETSPY_REPLAY_LINES 2
+#define TELNETSPY_REPLAY_SINCE 3
+#define TELNETSPY_REPLAY TELNETSPY_REPLAY_ALL
+#define TELNETSPY_REPLAY_BUDGET 0
+#define TELNETSPY_LIVE_MSG "TelnetSpy: ---- live ----\r\n"
+#define TELNETSPY_TASK_CORE 0
+#define TELNETSPY_TASK_PRIORITY 1
+#define TELNETSPY_TASK_STACK 4096
+#define TELNETSPY_TASK_POLL_TIME 20
+#define TELNETSPY_TASK_IDLE_TIME 500
+#define TELNETSPY_TRANSPORT_REC_LEN 256
+#define TELNETSPY_TRANSPORT_SLOTS (TELNETSPY_MAX_CLIENTS + 1)
+#define TELNETSPY_SYSLOG_PORT 514
+#define TELNETSPY_SYSLOG_APP_NAME "TelnetSpy"
+#define TELNETSPY_SYSLOG_FACILITY 16
+#define TELNETSPY_SYSLOG_MTU 1024
+#define TELNETSPY_SYSLOG_RATE 20
+#define TELNETSPY_SYSLOG_HEADER_LEN 128
+#define TELNETSPY_STORAGE_MAGIC 0x59505354
+#define TELNETSPY_STORAGE_HEADER_LEN 16
+#define TELNETSPY_RESTART_MSG "TelnetSpy: ---- restart ----\r\n"
+#ifdef ESP8266
+#define TELNETSPY_RTC_STORAGE_LEN 512
+#else
+#define TELNETSPY_RTC_STORAGE_LEN 2048
+#endif
 
 #ifdef ESP8266
 #include <ESP8266WiFi.h>
@@ -263,44 +647,369 @@
 #define WIFI_MODE_STA   STATION_MODE
 #define WIFI_MODE_AP    SOFTAP_MODE
 #define WIFI_MODE_APSTA STATIONAP_MODE
+#define TELNETSPY_ATOMIC(type) type
 #else // ESP32
 #include <WiFi.h>
+#ifdef TELNETSPY_LOCK_FREE
+#include <atomic>
+// single producer / single consumer: no spinlock, the fill levels are atomic
+#define CRITCAL_SECTION_MUTEX
+#define CRITCAL_SECTION_START
+#define CRITCAL_SECTION_END
+#define TELNETSPY_ATOMIC(type) std::atomic<type>
+#else
 // add spinlock for ESP32
 #define CRITCAL_SECTION_MUTEX portMUX_TYPE AtomicMutex = portMUX_INITIALIZER_UNLOCKED;
 // Non-static Data Member Initializers, see: https://web.archive.org/web/20160316174223/https://blogs.oracle.com/pcarlini/entry/c_11_tidbits_non_static
 #define CRITCAL_SECTION_START portENTER_CRITICAL(&AtomicMutex);
 #define CRITCAL_SECTION_END portEXIT_CRITICAL(&AtomicMutex);
+#define TELNETSPY_ATOMIC(type) type
+#endif
 #endif
 #include <WiFiClient.h>
+#include <WiFiUdp.h>
+#include <FS.h>
+#ifdef TELNETSPY_ASYNC_TCP
+#ifdef ESP8266
+#include <ESPAsyncTCP.h>
+#else
+#include <AsyncTCP.h>
+#endif
+#endif
+
+struct TelnetSpyStats {
+	uint32_t bytesWritten;		// data written to TelnetSpy (incl. os_print)
+	uint32_t bytesSent;			// data sent to the telnet clients
+	uint32_t bytesEvicted;		// old data removed from the full buffer
+	uint32_t linesEvicted;		// old lines removed from the full buffer
+	uint32_t bytesDiscarded;	// data not stored (see setStoreOffline, setSeverityThreshold, ...)
+	uint32_t recOverflows;		// data lost because the receive buffer was full
+	uint32_t serialDropped;		// data not sent to the serial port because its queue was full
+	uint32_t sendBlockCalls;	// calls of sendBlock
+	uint32_t blockSizes[TELNETSPY_STATS_BLOCK_CLASSES];	// blocks of 1-15, 16-63, 64-255, 256-1023, 1024+ bytes
+	uint32_t peakBufUsed;		// maximum fill level of the transmit buffer
+	uint32_t connects;			// accepted telnet connections
+	uint32_t handleTime;		// time spent in handle (in us)
+	uint32_t sendBlockTime;		// time spent in sendBlock (in us)
+	uint32_t bytesCompressed;	// data moved into the compressed backlog
+	uint32_t compressedSize;	// size of this data in the backlog
+	uint32_t bytesDeflated;		// data sent to clients with compression (see setCompression)
+	uint32_t deflatedSize;		// size of this data on the network
+	uint32_t linesRejected;		// new lines not stored because the buffer was full (see setOverflowPolicy)
+	uint32_t linesSampled;		// new lines skipped by the sampling (see setOverflowPolicy)
+	uint32_t blockCount;		// writes which waited for free space in the buffer (see setOverflowPolicy)
+	uint32_t blockTime;			// time spent waiting (in us)
+	uint32_t blockTimeouts;		// waits which ended by the timeout
+};
+
+struct TelnetSpyDeflate;
+
+// Memory which survives a restart, see setStorage
+class TelnetSpyStorage {
+	public:
+		virtual ~TelnetSpyStorage() {}
+		virtual uint16_t size() = 0;
+		virtual bool read(uint16_t offset, uint8_t* data, uint16_t len) = 0;
+		virtual bool write(uint16_t offset, const uint8_t* data, uint16_t len) = 0;
+};
+
+// RTC user memory (ESP8266) or RTC_NOINIT memory (ESP32)
+class TelnetSpyRtcStorage : public TelnetSpyStorage {
+	public:
+		TelnetSpyRtcStorage(uint16_t offset = 0, uint16_t size = TELNETSPY_RTC_STORAGE_LEN);
+		uint16_t size() override;
+		bool read(uint16_t offset, uint8_t* data, uint16_t len) override;
+		bool write(uint16_t offset, const uint8_t* data, uint16_t len) override;
+
+	protected:
+		uint16_t start;
+		uint16_t length;
+};
+
+// A file of a file system (i.e. LittleFS or SD)
+class TelnetSpyFileStorage : public TelnetSpyStorage {
+	public:
+		TelnetSpyFileStorage(fs::FS& fileSystem, const char* fileName, uint16_t size);
+		~TelnetSpyFileStorage();
+		uint16_t size() override;
+		bool read(uint16_t offset, uint8_t* data, uint16_t len) override;
+		bool write(uint16_t offset, const uint8_t* data, uint16_t len) override;
+
+	protected:
+		fs::FS& fileSys;
+		char* path;
+		uint16_t length;
+};
+
+// Network connections of the telnet clients, see setTransport. The slots
+// 0 ... TELNETSPY_MAX_CLIENTS - 1 are the clients, the slot
+// TELNETSPY_MAX_CLIENTS is used to send the reject message.
+class TelnetSpyTransport {
+	public:
+		TelnetSpyTransport() : wakeupCallback(NULL), wakeupArg(NULL) {}
+		virtual ~TelnetSpyTransport() {}
+		// Start listening, returns false if the network isn't ready yet
+		virtual bool begin(uint16_t port) = 0;
+		// Close all connections and stop listening
+		virtual void end() = 0;
+		virtual void setNoDelay(bool) {}
+		// A new connection is waiting, accept() puts it into the slot
+		virtual bool hasClient() = 0;
+		virtual bool accept(uint8_t slot) = 0;
+		virtual bool connected(uint8_t slot) = 0;
+		// Space for write() without blocking, -1 if unknown
+		virtual int availableForWrite(uint8_t) { return -1; }
+		virtual size_t write(uint8_t slot, const uint8_t* data, size_t len) = 0;
+		virtual int available(uint8_t slot) = 0;
+		virtual int read(uint8_t slot, uint8_t* data, size_t len) = 0;
+		virtual int peek(uint8_t slot) = 0;
+		virtual void flush(uint8_t) {}
+		virtual void stop(uint8_t slot) = 0;
+		// True if every line is to be preceded by IAC and its severity
+		// (TELNETSPY_SEVERITY_...)
+		virtual bool lineSeverities() { return false; }
+		// False if connects, disconnects and received data call wakeup(), so
+		// the task of TelnetSpy (see startTask) sleeps while nothing happens
+		virtual bool polled() { return true; }
+		void setWakeup(void (*callback)(void*), void* arg) {
+			wakeupCallback = callback;
+			wakeupArg = arg;
+		}
+
+	protected:
+		void wakeup() {
+			void (*callback)(void*) = wakeupCallback;
+			if (callback) {
+				callback(wakeupArg);
+			}
+		}
+		void (*volatile wakeupCallback)(void*);
+		void* wakeupArg;
+};
+
+// WiFiServer and WiFiClient (default)
+class TelnetSpyWiFiTransport : public TelnetSpyTransport {
+	public:
+		TelnetSpyWiFiTransport();
+		~TelnetSpyWiFiTransport();
+		bool begin(uint16_t port) override;
+		void end() override;
+		void setNoDelay(bool noDelay) override;
+		bool hasClient() override;
+		bool accept(uint8_t slot) override;
+		bool connected(uint8_t slot) override;
+		int availableForWrite(uint8_t slot) override;
+		size_t write(uint8_t slot, const uint8_t* data, size_t len) override;
+		int available(uint8_t slot) override;
+		int read(uint8_t slot, uint8_t* data, size_t len) override;
+		int peek(uint8_t slot) override;
+		void flush(uint8_t slot) override;
+		void stop(uint8_t slot) override;
+
+	protected:
+		WiFiServer* server;
+		WiFiClient clients[TELNETSPY_TRANSPORT_SLOTS];
+		bool noDelay;
+};
+
+#ifdef TELNETSPY_ASYNC_TCP
+// AsyncServer and AsyncClient of the libraries AsyncTCP (ESP32) or
+// ESPAsyncTCP (ESP8266): connects and received data are delivered by
+// callbacks and write() never blocks
+class TelnetSpyAsyncTransport : public TelnetSpyTransport {
+	public:
+		TelnetSpyAsyncTransport();
+		~TelnetSpyAsyncTransport();
+		bool begin(uint16_t port) override;
+		void end() override;
+		void setNoDelay(bool noDelay) override;
+		bool hasClient() override;
+		bool accept(uint8_t slot) override;
+		bool connected(uint8_t slot) override;
+		int availableForWrite(uint8_t slot) override;
+		size_t write(uint8_t slot, const uint8_t* data, size_t len) override;
+		int available(uint8_t slot) override;
+		int read(uint8_t slot, uint8_t* data, size_t len) override;
+		int peek(uint8_t slot) override;
+		void stop(uint8_t slot) override;
+		bool polled() override { return false; }
+
+	protected:
+		void onConnect(AsyncClient* client);
+		void onData(AsyncClient* client, const uint8_t* data, size_t len);
+		void onDisconnect(AsyncClient* client);
+		void lock();
+		void unlock();
+		AsyncServer* server;
+		AsyncClient* pending;
+		AsyncClient* clients[TELNETSPY_TRANSPORT_SLOTS];
+		uint8_t recBuf[TELNETSPY_TRANSPORT_SLOTS + 1][TELNETSPY_TRANSPORT_REC_LEN];
+		uint16_t recRdIdx[TELNETSPY_TRANSPORT_SLOTS + 1];
+		uint16_t recUsed[TELNETSPY_TRANSPORT_SLOTS + 1];
+		bool noDelay;
+#ifndef ESP8266
+		SemaphoreHandle_t mutex;
+#endif
+};
+#endif
+
+// Connections in memory, for tests and benchmarks without network. The
+// test plays the clients: connectClient() is accepted by the next handle(),
+// the sent data is collected up to "window" bytes per slot (write() takes
+// less if it is full, like a TCP send buffer) and removed by output().
+// Use window 0 for a sink which takes and drops everything.
+class TelnetSpyLoopbackTransport : public TelnetSpyTransport {
+	public:
+		TelnetSpyLoopbackTransport(size_t window = 0);
+		~TelnetSpyLoopbackTransport();
+		void connectClient();
+		void disconnectClient(uint8_t slot);
+		size_t input(uint8_t slot, const uint8_t* data, size_t len);
+		size_t output(uint8_t slot, uint8_t* data, size_t len);
+		uint32_t getSent(uint8_t slot);
+		bool begin(uint16_t port) override;
+		void end() override;
+		bool hasClient() override;
+		bool accept(uint8_t slot) override;
+		bool connected(uint8_t slot) override;
+		int availableForWrite(uint8_t slot) override;
+		size_t write(uint8_t slot, const uint8_t* data, size_t len) override;
+		int available(uint8_t slot) override;
+		int read(uint8_t slot, uint8_t* data, size_t len) override;
+		int peek(uint8_t slot) override;
+		void stop(uint8_t slot) override;
+		bool polled() override { return false; }
+
+	protected:
+		size_t winLen;
+		uint8_t pending;
+		bool open[TELNETSPY_TRANSPORT_SLOTS];
+		uint8_t* outBuf[TELNETSPY_TRANSPORT_SLOTS];
+		size_t outUsed[TELNETSPY_TRANSPORT_SLOTS];
+		uint32_t sent[TELNETSPY_TRANSPORT_SLOTS];
+		uint8_t inBuf[TELNETSPY_TRANSPORT_SLOTS][TELNETSPY_TRANSPORT_REC_LEN];
+		uint16_t inRdIdx[TELNETSPY_TRANSPORT_SLOTS];
+		uint16_t inUsed[TELNETSPY_TRANSPORT_SLOTS];
+};
+
+// RFC 5424 syslog messages in UDP datagrams (RFC 5426). The text sent to
+// the "client" is split into lines, every line is a message in its own
+// datagram (lines longer than "mtu" bytes are split).
+class TelnetSpySyslogTransport : public TelnetSpyTransport {
+	public:
+		TelnetSpySyslogTransport(IPAddress server, uint16_t port = TELNETSPY_SYSLOG_PORT,
+				const char* hostname = NULL, const char* appName = TELNETSPY_SYSLOG_APP_NAME);
+		~TelnetSpySyslogTransport();
+		bool setMtu(uint16_t newMtu);
+		void setRateLimit(uint16_t perSecond);
+		uint32_t getDatagramCount();
+		bool begin(uint16_t port) override;
+		void end() override;
+		bool hasClient() override;
+		bool accept(uint8_t slot) override;
+		bool connected(uint8_t slot) override;
+		int availableForWrite(uint8_t slot) override;
+		size_t write(uint8_t slot, const uint8_t* data, size_t len) override;
+		int available(uint8_t slot) override;
+		int read(uint8_t slot, uint8_t* data, size_t len) override;
+		int peek(uint8_t slot) override;
+		void flush(uint8_t slot) override;
+		void stop(uint8_t slot) override;
+		bool lineSeverities() override;
+
+	protected:
+		bool sendLine();
+		void refillTokens();
+		bool takeToken();
+		WiFiUDP udp;
+		IPAddress serverIp;
+		uint16_t serverPort;
+		char* host;
+		char* app;
+		char* packet;
+		uint16_t mtu;
+		uint16_t textMax;
+		uint16_t textLen;
+		uint8_t level;
+		uint8_t iacState;
+		uint16_t rate;
+		uint16_t tokens;
+		unsigned long tokenRef;
+		uint8_t openSlot;
+		uint32_t datagrams;
+};
 
 class TelnetSpy : public Stream {
 	public:
-		TelnetSpy();
+		TelnetSpy(char* buffer = NULL, size_t size = 0, char* recBuffer = NULL, size_t recSize = 0);
 		~TelnetSpy();
 		void handle(void);
 		void setPort(uint16_t portToUse);
 		void setWelcomeMsg(const char* msg);
 		void setWelcomeMsg(const String& msg);
+		void setWelcomeMsg(const __FlashStringHelper* msg);
 		void setRejectMsg(const char* msg);
 		void setRejectMsg(const String& msg);
+		void setRejectMsg(const __FlashStringHelper* msg);
 		void setMinBlockSize(uint16_t minSize);
 		void setCollectingTime(uint16_t colTime);
 		void setMaxBlockSize(uint16_t maxSize);
-		bool setBufferSize(uint16_t newSize);
-		uint16_t getBufferSize();
+		bool setBufferSize(size_t newSize);
+		size_t getBufferSize();
+		bool setBuffer(char* buffer, size_t size);
+		void setExternalRam(bool external);
+		bool getExternalRam();
 		void setStoreOffline(bool store);
 		bool getStoreOffline();
 		void setPingTime(uint16_t pngTime);
-		bool setRecBufferSize(uint16_t newSize);
-		uint16_t getRecBufferSize();
+		bool setRecBufferSize(size_t newSize);
+		size_t getRecBufferSize();
+		bool setRecBuffer(char* buffer, size_t size);
 		void setSerial(HardwareSerial* usedSerial);
+		bool setSerialQueueSize(uint16_t newSize);
+		uint16_t getSerialQueueSize();
 		bool isClientConnected();
+		void setMaxClients(uint8_t maxCount);
+		uint8_t getMaxClients();
+		uint8_t getClientCount();
+		uint32_t getDroppedCount(uint8_t slot);
+		TelnetSpyStats getStats();
+		void resetStats();
+		void setTimestamps(bool enable);
+		bool getTimestamps();
+		void setSeverity(uint8_t level);
+		uint8_t getSeverity();
+		void setSeverityThreshold(uint8_t level);
+		uint8_t getSeverityThreshold();
+		void setPriorityEviction(bool enable);
+		bool getPriorityEviction();
+		void setOverflowPolicy(uint8_t policy, uint16_t value = 0);
+		uint8_t getOverflowPolicy();
+		bool setBacklogSize(uint16_t newSize);
+		uint16_t getBacklogSize();
+		bool setStorage(TelnetSpyStorage* newStorage);
+		void setSaveTime(uint16_t time);
+		bool saveBuffer();
+		void setCompression(bool enable);
+		bool getCompression();
+		void setTransport(TelnetSpyTransport* newTransport);
+		void setReplay(uint8_t mode, uint32_t value = 0);
+		uint8_t getReplay();
+		void setReplayBudget(uint16_t bytes);
+		uint16_t getReplayBudget();
+#ifndef ESP8266
+		bool startTask(uint8_t core = TELNETSPY_TASK_CORE, uint8_t priority = TELNETSPY_TASK_PRIORITY,
+				uint32_t stackSize = TELNETSPY_TASK_STACK);
+		void stopTask();
+#endif
 		void setCallbackOnConnect(void (*callback)());
 		void setCallbackOnDisconnect(void (*callback)());
         void disconnectClient();
+        void disconnectClient(uint8_t slot);
         void clearBuffer();
         void setFilter(char ch, const char* msg, void (*callback)());
         void setFilter(char ch, const String& msg, void (*callback)());
+        void setFilter(char ch, const __FlashStringHelper* msg, void (*callback)());
         char getFilter();
 		void setCallbackOnNvtBRK(void (*callback)());
 		void setCallbackOnNvtIP(void (*callback)());
@@ -331,10 +1040,14 @@ class TelnetSpy : public Stream {
 		int available(void) override;
 		int peek(void) override;
 		int read(void) override;
+		int read(uint8_t* buffer, size_t len);
+		size_t readBytes(char* buffer, size_t length);
+		inline size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*) buffer, length); }
 		int availableForWrite(void);
 		void flush(void) override;
 		void debugWrite(uint8_t);
 		size_t write(uint8_t) override;
+		size_t write(const uint8_t* data, size_t len) override;
 		inline size_t write(unsigned long n) { return write((uint8_t) n); }
 		inline size_t write(long n) { return write((uint8_t) n); }
 		inline size_t write(unsigned int n) { return write((uint8_t) n); }
@@ -346,15 +1059,89 @@ class TelnetSpy : public Stream {
 
 	protected:
 		CRITCAL_SECTION_MUTEX
+		void handleConnection(void);
+		void lockClients();
+		void unlockClients();
+#ifndef ESP8266
+		static void taskLoop(void* arg);
+		static void wakeupTask(void* arg);
+		void notifyTask();
+		TaskHandle_t task;
+		SemaphoreHandle_t taskMutex;
+		volatile bool taskStop;
+#endif
 		void sendBlock(void);
+		uint16_t sendRange(uint8_t slot, size_t* pos, unsigned long* stamp, uint8_t* stampPos,
+				size_t end, uint16_t blockLen, bool lines, bool* midLine);
+		void countBlock(uint16_t len);
 		void addTelnetBuf(char c);
-		char pullTelnetBuf();
-		char peekTelnetBuf();
+		void addTelnetBuf(const uint8_t* data, size_t len);
+		void dropTelnetLine();
+		bool evictTelnetLine(uint8_t level);
+		void moveTelnetBuf(size_t len, size_t dist);
+		void storeTelnetBuf(const uint8_t* data, size_t len, bool sendIfFull);
+		void storeTelnetData(const uint8_t* data, size_t len, bool sendIfFull);
+		void waitTelnetBuf(size_t size);
+		bool mayWaitTelnetBuf();
+		bool rejectLine();
+		size_t recordSize(const uint8_t* data, size_t len, unsigned long now);
+		uint8_t recordHeader(uint8_t* hdr, unsigned long delta, uint8_t level);
+		void addTelnetRecords(const uint8_t* data, size_t len, unsigned long now);
+		uint16_t recordAt(const char* buf, size_t size, size_t idx, uint32_t* value, uint8_t* level);
+		unsigned long skipRecords(size_t idx, size_t len, unsigned long stamp);
+		size_t replayStart();
+		size_t renderRecords(const char* buf, size_t bufSize, size_t idx, size_t avail,
+				unsigned long* stamp, uint8_t* skip, char* out, size_t outLen, size_t* raw);
+		bool compressTelnetBuf();
+		uint16_t unpackBacklog(uint16_t pos, uint8_t* data, unsigned long* stamp);
+		uint16_t backlogBlockSize(uint16_t pos);
+		void releaseBacklog(uint16_t len);
+		bool restoreBuffer();
+		bool prependTelnetBuf(const char* text, size_t len);
+		void setRecords(bool useTimestamps, bool useSeverities);
+		void releaseTelnetBuf(size_t len);
+		void packTelnetBuf(size_t size);
+		size_t writeSerial(const uint8_t* data, size_t len);
+		void sendSerialQueue(bool wait);
+		void skipClientCursors(size_t len);
+		bool clientsConnected();
 		int telnetAvailable();
         void writeRecBuf(char c);
+        void writeRecBuf(const char* data, uint16_t len);
+        void nvtCommand(uint8_t slot, uint8_t command, uint8_t option);
+		uint16_t writeClient(uint8_t slot, const uint8_t* data, uint16_t len);
+		void writeClients(const uint8_t* data, size_t len);
+		void writeMsg(uint8_t slot, const char* msg, bool flash);
+		void endCompression(uint8_t slot, bool finish = false);
+		bool flushCompression(uint8_t slot);
+		void resetClient(uint8_t slot);
         void checkReceive();
-		WiFiServer* telnetServer;
-		WiFiClient client;
+        void checkReceive(uint8_t slot);
+		TelnetSpyWiFiTransport wifiTransport;
+		TelnetSpyTransport* transport;
+		bool connected[TELNETSPY_MAX_CLIENTS];
+		size_t clientSent[TELNETSPY_MAX_CLIENTS];
+		uint32_t clientDropped[TELNETSPY_MAX_CLIENTS];
+		unsigned long clientStamp[TELNETSPY_MAX_CLIENTS];
+		uint8_t clientStampPos[TELNETSPY_MAX_CLIENTS];
+		size_t clientLive[TELNETSPY_MAX_CLIENTS];
+		bool clientReplay[TELNETSPY_MAX_CLIENTS];
+		bool clientReplayMid[TELNETSPY_MAX_CLIENTS];		// the replay stopped inside of a line
+		uint16_t clientReplayLeft[TELNETSPY_MAX_CLIENTS];	// budget of the replay in this handle()
+		size_t clientLiveSent[TELNETSPY_MAX_CLIENTS];		// cursor of the live data during the replay
+		unsigned long clientLiveStamp[TELNETSPY_MAX_CLIENTS];
+		uint8_t clientLiveStampPos[TELNETSPY_MAX_CLIENTS];
+		bool clientLiveMid[TELNETSPY_MAX_CLIENTS];			// the live data stopped inside of a line
+		uint8_t replayMode;
+		uint32_t replayValue;
+		uint16_t replayBudget;
+		uint16_t clientBacklog[TELNETSPY_MAX_CLIENTS];
+		uint16_t clientBacklogPos[TELNETSPY_MAX_CLIENTS];
+		uint8_t nvtState[TELNETSPY_MAX_CLIENTS];
+		uint8_t nvtCmd[TELNETSPY_MAX_CLIENTS];
+		TelnetSpyDeflate* deflate[TELNETSPY_MAX_CLIENTS];
+		bool compression;
+		uint8_t maxClients;
 		uint16_t port;
 		HardwareSerial* usedSer;
 		bool storeOffline;
@@ -365,26 +1152,66 @@ class TelnetSpy : public Stream {
 		unsigned long pingRef;
 		uint16_t pingTime;
         bool nvtDetected;
-		char* welcomeMsg;
-		char* rejectMsg;
+		TelnetSpyStats stats;
+		bool timestamps;
+		bool severities;
+		bool severityMarks;		// the transport gets the severity of every line
+		bool records;
+		bool lineStart;
+		bool skipLine;
+		uint8_t severity;
+		uint8_t severityThreshold;
+		uint8_t overflowPolicy;
+		uint16_t overflowValue;
+		uint16_t sampleCount;
+		bool overflowStalled;
+		bool handling;			// inside of handle(), its callbacks can't wait
+		unsigned long lastStamp;
+		unsigned long bufStamp;
+		uint32_t bufChanges;		// counts drops and moves of buffered data
+		char* renderBuf;
+		const char* welcomeMsg;
+		const char* rejectMsg;
+		bool welcomeMsgFlash;
+		bool rejectMsgFlash;
         char filterChar;
-        char* filterMsg;
+        const char* filterMsg;
+        bool filterMsgFlash;
         void (*filterCallback)();
 		uint16_t minBlockSize;
 		uint16_t collectingTime;
 		uint16_t maxBlockSize;
 		bool debugOutput;
 		char* telnetBuf;
-		uint16_t bufLen;
-		uint16_t bufUsed;
-		uint16_t bufRdIdx;
-		uint16_t bufWrIdx;
+		size_t bufLen;
+		TELNETSPY_ATOMIC(size_t) bufUsed;
+		size_t bufRdIdx;
+		size_t bufWrIdx;
+		char* bufRegion;
+		size_t bufRegionLen;
+		bool externalRam;
+		uint8_t* backlogBuf;
+		uint8_t* backlogTmp;
+		uint16_t backlogLen;
+		uint16_t backlogStart;	// the oldest block, released blocks aren't moved
+		uint16_t backlogUsed;
+		bool backlogBusy;		// a block is packed outside of the critical section
+		TelnetSpyStorage* storage;
+		uint16_t saveTime;
+		unsigned long saveRef;
+		bool saveDirty;
+		char* serBuf;
+		uint16_t serLen;
+		TELNETSPY_ATOMIC(uint16_t) serUsed;
+		uint16_t serRdIdx;
+		uint16_t serWrIdx;
 		char* recBuf;
-		uint16_t recLen;
-		uint16_t recUsed;
-		uint16_t recRdIdx;
-		uint16_t recWrIdx;
-		bool connected;
+		size_t recLen;
+		TELNETSPY_ATOMIC(size_t) recUsed;
+		size_t recRdIdx;
+		size_t recWrIdx;
+		char* recRegion;
+		size_t recRegionLen;
 		void (*callbackConnect)();
 		void (*callbackDisconnect)();
         void (*callbackNvtBRK)();
@@ -0,0 +1,73 @@
+/*
+ * Compressed backlog: ratio and CPU time of the compression for some kinds
+ * of log text, written offline into a full transmit buffer (without backlog
+ * the oldest lines are dropped instead)
+ */
+
+#include "host_test.h"
+
+#define BENCH_LINES 50000
+
+enum Text { TEXT_SENSOR, TEXT_MIXED, TEXT_RANDOM };
+static const char* textNames[] = { "sensor", "mixed", "random" };
+
+static int makeLine(Text text, int i, char* line, size_t size) {
+	static const char* states[] = { "idle", "connecting", "connected", "sending", "error: timeout" };
+	switch (text) {
+		case TEXT_SENSOR:
+			return snprintf(line, size, "[sensor] temperature=%d.%d humidity=%d pressure=1013.2 rssi=-%d\n",
+					21, i % 10, 48, i % 90);
+		case TEXT_MIXED:
+			return snprintf(line, size, "%lu wifi: %s (%d) heap=%d\n", millis(), states[(i * 7) % 5],
+					i % 13, 30000 - (i * 37) % 4096);
+		default: {
+			int len = 40 + i % 24;
+			for (int j = 0; j < len; j++) {
+				line[j] = 0x21 + rand() % 94;
+			}
+			line[len] = '\n';
+			line[len + 1] = 0;
+			return len + 1;
+		}
+	}
+}
+
+static void bench(Text text, bool timestamps, uint16_t backlogSize) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setBufferSize(4096);
+	spy.setBacklogSize(backlogSize);
+	spy.setTimestamps(timestamps);
+	spy.begin(115200);
+	srand(1);
+	char line[80];
+	double bytes = 0;
+	double ns = 0;
+	for (int i = 0; i < BENCH_LINES; i++) {
+		int len = makeLine(text, i, line, sizeof(line));
+		auto start = std::chrono::steady_clock::now();
+		spy.write((const uint8_t*) line, len);
+		ns += elapsedNs(start);
+		bytes += len;
+		hostAdvance(1);
+	}
+	TelnetSpyStats stats = spy.getStats();
+	// Text which can't be packed is dropped like without backlog
+	char ratio[16] = "-";
+	if (stats.bytesCompressed) {
+		snprintf(ratio, sizeof(ratio), "%.1f %%", 100.0 * stats.compressedSize / stats.bytesCompressed);
+	}
+	printf("%-7s %-5s %7u %8.1f %9.1f %8s\n", textNames[text], timestamps ? "yes" : "no",
+			backlogSize, ns / bytes, bytes / ns * 1000.0, ratio);
+}
+
+int main() {
+	printf("%-7s %-5s %7s %8s %9s %8s\n", "text", "stamp", "backlog", "ns/byte", "MB/s", "ratio");
+	for (int t = TEXT_SENSOR; t <= TEXT_RANDOM; t++) {
+		for (int stamp = 0; stamp <= 1; stamp++) {
+			bench((Text) t, stamp, 0);
+			bench((Text) t, stamp, 16384);
+		}
+	}
+	return 0;
+}
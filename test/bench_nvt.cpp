@@ -0,0 +1,53 @@
+/*
+ * Throughput of the receive path (checkReceive with the NVT parser) for
+ * plain text and for text with telnet commands, received in fragments of
+ * some sizes
+ */
+
+#include "host_test.h"
+
+#define BENCH_BYTES 2000000
+
+static void bench(const char* name, const std::string& chunk, size_t fragment) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setRecBufferSize(4096);
+	spy.begin(115200);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 10);
+	std::string stream;
+	while (stream.size() < fragment) {
+		stream += chunk;
+	}
+	stream.resize(fragment);
+	uint8_t buf[256];
+	double bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (bytes < BENCH_BYTES) {
+		conn->send(stream);
+		spy.handle();
+		while (spy.read(buf, sizeof(buf)) > 0) {
+		}
+		bytes += stream.size();
+	}
+	double ns = elapsedNs(start);
+	printf("%-10s %8zu %8.2f %9.1f\n", name, fragment, ns / bytes, bytes / ns * 1000.0);
+}
+
+int main() {
+	std::string text = "ls -l /data/logs | grep error && echo done\r\n";
+	// AYT, DO TERMINAL-TYPE, SB TERMINAL-TYPE IS "xterm" SE and an escaped 0xff
+	static const char commands[] = "\xff\xf6\xff\xfd\x18\xff\xfa\x18\x00xterm\xff\xf0\xff\xff";
+	std::string mixed = text + std::string(commands, sizeof(commands) - 1);
+	printf("%-10s %8s %8s %9s\n", "input", "fragment", "ns/byte", "MB/s");
+	size_t fragments[] = { 1, 16, 536, 1460 };
+	for (size_t fragment : fragments) {
+		bench("text", text, fragment);
+	}
+	for (size_t fragment : fragments) {
+		bench("commands", mixed, fragment);
+	}
+	return 0;
+}
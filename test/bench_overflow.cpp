@@ -0,0 +1,74 @@
+/*
+ * Overflow policies under a saturated link: the writer offers twice the data
+ * the link takes, the table shows how many lines arrive, how much new data
+ * wasn't stored, how long the writer was blocked and the CPU time per line
+ */
+
+#include "host_test.h"
+
+#define BENCH_MS 2000
+#define LINK_RATE 1000		// bytes per ms the link takes
+#define LINES_PER_MS 32		// about 2000 bytes per ms
+
+static TelnetSpyLoopbackTransport* link = NULL;
+static size_t received;
+static size_t receivedLines;
+
+static void takeLink(unsigned long ms) {
+	// The link takes LINK_RATE bytes per ms from the TCP send buffer
+	uint8_t buf[LINK_RATE];
+	for (unsigned long i = 0; i < ms; i++) {
+		size_t n = link->output(0, buf, sizeof(buf));
+		received += n;
+		for (size_t j = 0; j < n; j++) {
+			receivedLines += (buf[j] == '\n');
+		}
+	}
+}
+
+static void bench(const char* name, uint8_t policy, uint16_t value) {
+	// The transport outlives TelnetSpy, which sends the rest at the end
+	TelnetSpyLoopbackTransport loopback(1460);
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(4096);
+	spy.setOverflowPolicy(policy, value);
+	spy.setTransport(&loopback);
+	spy.begin(115200);
+	loopback.connectClient();
+	link = &loopback;
+	hostDelayHook = takeLink;
+	runHandle(spy, 10);
+	received = 0;
+	receivedLines = 0;
+	unsigned long startMs = millis();
+	double ns = 0;
+	int lines = 0;
+	while (millis() - startMs < BENCH_MS) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < LINES_PER_MS; i++) {
+			spy.printf("%8d [sensor] temperature=21.%d humidity=48 rssi=-%d\n", lines++, lines % 10, lines % 90);
+		}
+		ns += elapsedNs(start);
+		hostAdvance(1);
+		takeLink(1);
+		spy.handle();
+	}
+	unsigned long duration = millis() - startMs;
+	hostDelayHook = NULL;
+	TelnetSpyStats stats = spy.getStats();
+	printf("%-12s %7d %6.1f %% %10u %7lu %6lu %8.1f\n", name, lines, 100.0 * receivedLines / lines,
+			(unsigned) stats.bytesDiscarded, (unsigned long) (stats.blockTime / 1000), duration, ns / lines);
+}
+
+int main() {
+	printf("%-12s %7s %8s %10s %7s %6s %8s\n", "policy", "lines", "arrived", "discarded", "blocked", "ms", "ns/line");
+	bench("drop oldest", TELNETSPY_OVERFLOW_DROP_OLDEST, 0);
+	bench("drop newest", TELNETSPY_OVERFLOW_DROP_NEWEST, 0);
+	bench("block 5", TELNETSPY_OVERFLOW_BLOCK, 5);
+	bench("block 100", TELNETSPY_OVERFLOW_BLOCK, 100);
+	bench("sample 10", TELNETSPY_OVERFLOW_SAMPLE, 10);
+	return 0;
+}
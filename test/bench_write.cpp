@@ -0,0 +1,75 @@
+/*
+ * Throughput of the write paths (write(uint8_t), write(buffer, size), printf
+ * and debugWrite) for some buffer and block sizes, with a connected client
+ * (handle() after every line) and offline (the full buffer drops old lines)
+ */
+
+#include "host_test.h"
+
+#define BENCH_LINES 100000
+
+static const char line[] = "[sensor] temperature=21.5 humidity=48 pressure=1013.2 rssi=-67\n";
+
+enum Path { PATH_BYTE, PATH_BUFFER, PATH_PRINTF, PATH_DEBUG };
+static const char* pathNames[] = { "write(uint8_t)", "write(buf, len)", "printf", "debugWrite" };
+
+static void bench(Path path, bool online, size_t bufSize, uint16_t minBlock, uint16_t maxBlock) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setPingTime(0);
+	spy.setBufferSize(bufSize);
+	spy.setMinBlockSize(minBlock);
+	spy.setMaxBlockSize(maxBlock);
+	spy.begin(115200);
+	std::shared_ptr<HostConnection> conn;
+	if (online) {
+		conn = hostConnect();
+		runHandle(spy, 200);
+	}
+	size_t len = strlen(line);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_LINES; i++) {
+		switch (path) {
+			case PATH_BYTE:
+				for (size_t j = 0; j < len; j++) {
+					spy.write((uint8_t) line[j]);
+				}
+				break;
+			case PATH_BUFFER:
+				spy.write((const uint8_t*) line, len);
+				break;
+			case PATH_PRINTF:
+				spy.printf("[sensor] temperature=%d.%d humidity=%d pressure=1013.2 rssi=-%d\n", 21, i % 10, 48, i % 90);
+				break;
+			case PATH_DEBUG:
+				for (size_t j = 0; j < len; j++) {
+					spy.debugWrite((uint8_t) line[j]);
+				}
+				break;
+		}
+		if (online) {
+			spy.handle();
+			conn->sent.clear();
+		}
+	}
+	double ns = elapsedNs(start);
+	double bytes = (double) BENCH_LINES * len;
+	printf("%-16s %-7s %6zu %5u %5u %8.1f %9.1f\n", pathNames[path], online ? "online" : "offline",
+			bufSize, minBlock, maxBlock, ns / bytes, bytes / ns * 1000.0);
+}
+
+int main() {
+	printf("%-16s %-7s %6s %5s %5s %8s %9s\n", "path", "client", "buffer", "min", "max", "ns/byte", "MB/s");
+	const size_t bufSizes[] = { 3000, 16384 };
+	const uint16_t blockSizes[][2] = { { 64, 512 }, { 64, 2920 }, { 512, 2920 } };
+	for (int p = PATH_BYTE; p <= PATH_DEBUG; p++) {
+		for (int online = 1; online >= 0; online--) {
+			for (size_t b : bufSizes) {
+				for (auto& blk : blockSizes) {
+					bench((Path) p, online, b, blk[0], blk[1]);
+				}
+			}
+		}
+	}
+	return 0;
+}
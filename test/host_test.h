@@ -0,0 +1,38 @@
+/*
+ * Helpers of the host tests
+ */
+
+#ifndef TELNETSPY_HOST_TEST_H
+#define TELNETSPY_HOST_TEST_H
+
+#include <TelnetSpy.h>
+#include <chrono>
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(a, b) do { \
+		if (!((a) == (b))) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__, __LINE__, #a, #b); \
+			exit(1); \
+		} \
+	} while (0)
+
+// Calls handle() "count" times, the time advances by "step" ms each
+static inline void runHandle(TelnetSpy& spy, int count = 1, unsigned long step = 1) {
+	for (int i = 0; i < count; i++) {
+		hostAdvance(step);
+		spy.handle();
+	}
+}
+
+// Returns the time since "start" in ns
+static inline double elapsedNs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
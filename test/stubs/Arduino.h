@@ -0,0 +1,183 @@
+/*
+ * Host stand-ins for the parts of the ESP8266 / ESP32 Arduino cores which
+ * are used by TelnetSpy, so the unchanged library can be built and tested on
+ * Linux. Build with -DESP8266 for the ESP8266 flavour, without it for ESP32.
+ */
+
+#ifndef TELNETSPY_HOST_ARDUINO_H
+#define TELNETSPY_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Time: the clock of the host is simulated, it only advances by delay() and
+// hostAdvance(), so the tests are deterministic
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void hostAdvance(unsigned long ms);
+// Called by delay(), i.e. to play a network link which takes data meanwhile
+extern void (*hostDelayHook)(unsigned long ms);
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*) PSTR(s))
+
+class String {
+	public:
+		String(const char* s = "") : str(s) {}
+		const char* c_str() const { return str.c_str(); }
+		unsigned int length() const { return str.length(); }
+	private:
+		std::string str;
+};
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t c) = 0;
+		virtual size_t write(const uint8_t* buffer, size_t size) {
+			size_t n = 0;
+			while (size-- && write(*buffer++)) {
+				n++;
+			}
+			return n;
+		}
+		size_t write(const char* str) { return str ? write((const uint8_t*) str, strlen(str)) : 0; }
+		size_t write(const char* buffer, size_t size) { return write((const uint8_t*) buffer, size); }
+		virtual int availableForWrite() { return 0; }
+		virtual void flush() {}
+		size_t print(const char* str) { return write(str); }
+		size_t print(const String& str) { return write(str.c_str()); }
+		size_t print(char c) { return write((uint8_t) c); }
+		size_t print(long n) { return printf("%ld", n); }
+		size_t print(int n) { return print((long) n); }
+		size_t print(unsigned long n) { return printf("%lu", n); }
+		size_t print(unsigned int n) { return print((unsigned long) n); }
+		size_t println() { return write("\r\n"); }
+		template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+		size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+			char buf[256];
+			va_list arg;
+			va_start(arg, format);
+			int len = vsnprintf(buf, sizeof(buf), format, arg);
+			va_end(arg);
+			if (len < 0) {
+				return 0;
+			}
+			if ((size_t) len < sizeof(buf)) {
+				return write((const uint8_t*) buf, len);
+			}
+			std::string big(len + 1, '\0');
+			va_start(arg, format);
+			vsnprintf(&big[0], big.size(), format, arg);
+			va_end(arg);
+			return write((const uint8_t*) big.data(), len);
+		}
+};
+
+class Stream : public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+		virtual size_t readBytes(char* buffer, size_t length) {
+			size_t n = 0;
+			int c;
+			while ((n < length) && ((c = read()) >= 0)) {
+				buffer[n++] = (char) c;
+			}
+			return n;
+		}
+		size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*) buffer, length); }
+		void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	protected:
+		unsigned long _timeout = 1000;
+};
+
+#ifdef ESP8266
+enum SerialConfig { SERIAL_8N1 = 0x1c };
+enum SerialMode { SERIAL_FULL = 0, SERIAL_RX_ONLY = 1, SERIAL_TX_ONLY = 2 };
+#else
+#define SERIAL_8N1 0x800001c
+#endif
+
+// A UART which collects the sent data in "output" and delivers "input",
+// "space" limits its free transmit space
+class HardwareSerial : public Stream {
+	public:
+		std::string output;
+		std::string input;
+		size_t space = SIZE_MAX;
+		size_t write(uint8_t c) override { return write(&c, 1); }
+		size_t write(const uint8_t* buffer, size_t size) override {
+			size = (size < space) ? size : space;
+			output.append((const char*) buffer, size);
+			if (space != SIZE_MAX) {
+				space -= size;
+			}
+			return size;
+		}
+		int availableForWrite() override { return (space > 0x7FFF) ? 0x7FFF : (int) space; }
+		int available() override { return input.size(); }
+		int read() override {
+			if (input.empty()) {
+				return -1;
+			}
+			uint8_t c = input[0];
+			input.erase(0, 1);
+			return c;
+		}
+		int peek() override { return input.empty() ? -1 : (uint8_t) input[0]; }
+		operator bool() const { return true; }
+#ifdef ESP8266
+		void begin(unsigned long baud, SerialConfig, SerialMode, uint8_t) { this->baud = baud; }
+		void swap(uint8_t) {}
+		void set_tx(uint8_t) {}
+		void pins(uint8_t, uint8_t) {}
+		bool isTxEnabled() { return true; }
+		bool isRxEnabled() { return true; }
+#else
+		void begin(unsigned long baud, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1, bool = false) { this->baud = baud; }
+#endif
+		void end() {}
+		uint32_t baudRate() { return baud; }
+	private:
+		uint32_t baud = 0;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+	public:
+		void restart();
+};
+
+extern EspClass ESP;
+extern int hostRestarts;
+
+#ifdef ESP8266
+extern "C" void ets_putc(char c);
+extern "C" void ets_install_putc1(void (*routine)(char));
+#else
+#include "freertos.h"
+extern "C" void ets_write_char_uart(char c);
+extern "C" void ets_install_putc1(void (*routine)(char));
+#define RTC_NOINIT_ATTR
+#endif
+
+// True while the test simulates an interrupt (can_yield() / xPortInIsrContext())
+extern bool hostInIsr;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TELNETSPY_HOST_ESP8266WIFI_H
+#define TELNETSPY_HOST_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <WiFiClient.h>
+
+enum WiFiMode_t { NULL_MODE = 0, STATION_MODE, SOFTAP_MODE, STATIONAP_MODE };
+enum wl_status_t { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 };
+
+class ESP8266WiFiClass {
+	public:
+		WiFiMode_t getMode();
+		wl_status_t status();
+		IPAddress localIP();
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Host stand-in for the file system API, the files are files of the host.
+ */
+
+#ifndef TELNETSPY_HOST_FS_H
+#define TELNETSPY_HOST_FS_H
+
+#include <Arduino.h>
+
+namespace fs {
+
+class File {
+	public:
+		File(FILE* f = NULL) : f(f) {}
+		operator bool() const { return f != NULL; }
+		bool seek(uint32_t pos) { return f && (fseek(f, pos, SEEK_SET) == 0); }
+		size_t read(uint8_t* buffer, size_t size) { return f ? fread(buffer, 1, size, f) : 0; }
+		size_t write(const uint8_t* buffer, size_t size) { return f ? fwrite(buffer, 1, size, f) : 0; }
+		size_t size() {
+			long pos = ftell(f);
+			fseek(f, 0, SEEK_END);
+			long len = ftell(f);
+			fseek(f, pos, SEEK_SET);
+			return len;
+		}
+		void close() {
+			if (f) {
+				fclose(f);
+				f = NULL;
+			}
+		}
+	private:
+		FILE* f;
+};
+
+class FS {
+	public:
+		bool exists(const char* path) {
+			FILE* f = fopen(path, "rb");
+			if (f) {
+				fclose(f);
+			}
+			return f != NULL;
+		}
+		File open(const char* path, const char* mode) {
+			std::string m(mode);
+			return File(fopen(path, (m + "b").c_str()));
+		}
+		bool remove(const char* path) { return ::remove(path) == 0; }
+};
+
+}
+
+using fs::File;
+
+#endif
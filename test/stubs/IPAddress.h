@@ -0,0 +1,14 @@
+#ifndef TELNETSPY_HOST_IPADDRESS_H
+#define TELNETSPY_HOST_IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress {
+	public:
+		IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes{a, b, c, d} {}
+		uint8_t operator[](int index) const { return bytes[index]; }
+	private:
+		uint8_t bytes[4];
+};
+
+#endif
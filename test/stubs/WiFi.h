@@ -0,0 +1,20 @@
+#ifndef TELNETSPY_HOST_WIFI_H
+#define TELNETSPY_HOST_WIFI_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <WiFiClient.h>
+
+typedef enum { WIFI_MODE_NULL = 0, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+typedef enum { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 } wl_status_t;
+
+class WiFiClass {
+	public:
+		wifi_mode_t getMode();
+		wl_status_t status();
+		IPAddress localIP();
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Host stand-ins for WiFiServer and WiFiClient: a test opens a connection with
+ * hostConnect() and reads / writes it like the telnet client would do.
+ */
+
+#ifndef TELNETSPY_HOST_WIFICLIENT_H
+#define TELNETSPY_HOST_WIFICLIENT_H
+
+#include <Arduino.h>
+#include <memory>
+#include <mutex>
+
+struct HostConnection {
+	std::string sent;			// data written by TelnetSpy
+	std::string received;		// data to be read by TelnetSpy
+	size_t window = SIZE_MAX;	// free space of the TCP send buffer
+	bool open = true;
+	std::mutex lock;			// TelnetSpy may write from a task
+	// Test side
+	std::string take() { std::lock_guard<std::mutex> guard(lock); std::string s; s.swap(sent); return s; }
+	void send(const std::string& data) { received += data; }
+	void close() { open = false; }
+};
+
+std::shared_ptr<HostConnection> hostConnect(size_t window = SIZE_MAX);
+
+class WiFiClient : public Stream {
+	public:
+		WiFiClient() {}
+		explicit WiFiClient(const std::shared_ptr<HostConnection>& connection) : conn(connection) {}
+		size_t write(uint8_t c) override { return write(&c, 1); }
+		size_t write(const uint8_t* buffer, size_t size) override {
+			if (!connected()) {
+				return 0;
+			}
+			std::lock_guard<std::mutex> guard(conn->lock);
+			size = (size < conn->window) ? size : conn->window;
+			conn->sent.append((const char*) buffer, size);
+			if (conn->window != SIZE_MAX) {
+				conn->window -= size;
+			}
+			return size;
+		}
+		int availableForWrite() override {
+			if (!connected()) {
+				return 0;
+			}
+			return (conn->window > 0x7FFF) ? 0x7FFF : (int) conn->window;
+		}
+		int available() override { return conn ? conn->received.size() : 0; }
+		int read() override {
+			uint8_t c;
+			return (read(&c, 1) == 1) ? c : -1;
+		}
+		int read(uint8_t* buffer, size_t size) {
+			if (!conn) {
+				return -1;
+			}
+			size = (size < conn->received.size()) ? size : conn->received.size();
+			memcpy(buffer, conn->received.data(), size);
+			conn->received.erase(0, size);
+			return size;
+		}
+		int peek() override { return (conn && !conn->received.empty()) ? (uint8_t) conn->received[0] : -1; }
+		void flush() override {}
+		uint8_t connected() { return conn && (conn->open || !conn->received.empty()); }
+		void stop() {
+			if (conn) {
+				conn->open = false;
+				conn.reset();
+			}
+		}
+		void setNoDelay(bool) {}
+	private:
+		std::shared_ptr<HostConnection> conn;
+};
+
+class WiFiServer {
+	public:
+		WiFiServer(uint16_t port) : port(port) {}
+		void begin() {}
+		void close() {}
+		void stop() {}
+		void setNoDelay(bool) {}
+		bool hasClient();
+		WiFiClient available();
+		WiFiClient accept() { return available(); }
+	private:
+		uint16_t port;
+};
+
+#endif
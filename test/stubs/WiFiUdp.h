@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for WiFiUDP which sends real datagrams (i.e. to a listener of
+ * the test on 127.0.0.1).
+ */
+
+#ifndef TELNETSPY_HOST_WIFIUDP_H
+#define TELNETSPY_HOST_WIFIUDP_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class WiFiUDP {
+	public:
+		~WiFiUDP();
+		int beginPacket(IPAddress ip, uint16_t port);
+		size_t write(const uint8_t* buffer, size_t size);
+		int endPacket();
+	private:
+		int sock = -1;
+		IPAddress ip;
+		uint16_t port = 0;
+		std::string packet;
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef TELNETSPY_HOST_COREDECLS_H
+#define TELNETSPY_HOST_COREDECLS_H
+
+extern "C" bool can_yield();
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef TELNETSPY_HOST_ESP_HEAP_CAPS_H
+#define TELNETSPY_HOST_ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// Counts the allocations in external RAM
+extern int hostSpiramAllocs;
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps);
+
+#endif
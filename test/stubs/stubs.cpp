@@ -0,0 +1,300 @@
+/*
+ * Implementation of the host stand-ins (see Arduino.h)
+ */
+
+#include <Arduino.h>
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#include <coredecls.h>
+#else
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#endif
+#include <WiFiUdp.h>
+extern "C" {
+#include <user_interface.h>
+}
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+static std::atomic<unsigned long> hostMicros(0);
+bool hostInIsr = false;
+int hostRestarts = 0;
+
+unsigned long millis() {
+	return hostMicros / 1000;
+}
+
+unsigned long micros() {
+	return hostMicros;
+}
+
+void (*hostDelayHook)(unsigned long ms) = NULL;
+
+void delay(unsigned long ms) {
+	hostMicros += ms * 1000;
+	if (hostDelayHook) {
+		hostDelayHook(ms);
+	}
+	std::this_thread::yield();
+}
+
+void yield() {
+	std::this_thread::yield();
+}
+
+void hostAdvance(unsigned long ms) {
+	hostMicros += ms * 1000;
+}
+
+HardwareSerial Serial;
+EspClass ESP;
+
+void EspClass::restart() {
+	hostRestarts++;
+}
+
+// Network
+
+static std::deque<std::shared_ptr<HostConnection>> hostPending;
+
+std::shared_ptr<HostConnection> hostConnect(size_t window) {
+	std::shared_ptr<HostConnection> conn = std::make_shared<HostConnection>();
+	conn->window = window;
+	hostPending.push_back(conn);
+	return conn;
+}
+
+bool WiFiServer::hasClient() {
+	return !hostPending.empty();
+}
+
+WiFiClient WiFiServer::available() {
+	if (hostPending.empty()) {
+		return WiFiClient();
+	}
+	WiFiClient client(hostPending.front());
+	hostPending.pop_front();
+	return client;
+}
+
+#ifdef ESP8266
+ESP8266WiFiClass WiFi;
+
+WiFiMode_t ESP8266WiFiClass::getMode() {
+	return STATION_MODE;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+	return WL_CONNECTED;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+	return IPAddress(192, 168, 4, 2);
+}
+#else
+WiFiClass WiFi;
+
+wifi_mode_t WiFiClass::getMode() {
+	return WIFI_MODE_STA;
+}
+
+wl_status_t WiFiClass::status() {
+	return WL_CONNECTED;
+}
+
+IPAddress WiFiClass::localIP() {
+	return IPAddress(192, 168, 4, 2);
+}
+#endif
+
+WiFiUDP::~WiFiUDP() {
+	if (sock >= 0) {
+		close(sock);
+	}
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+	this->ip = ip;
+	this->port = port;
+	packet.clear();
+	return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+	packet.append((const char*) buffer, size);
+	return size;
+}
+
+int WiFiUDP::endPacket() {
+	if (sock < 0) {
+		sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock < 0) {
+			return 0;
+		}
+	}
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl((ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | ip[3]);
+	return sendto(sock, packet.data(), packet.size(), 0, (sockaddr*) &addr, sizeof(addr)) == (ssize_t) packet.size();
+}
+
+// System
+
+static uint8_t hostRtcMem[768];
+
+void system_set_os_print(uint8_t) {
+}
+
+bool system_rtc_mem_read(uint8_t des_addr, void* src_addr, uint16_t save_size) {
+	if ((des_addr < 64) || ((size_t) des_addr * 4 + save_size > sizeof(hostRtcMem))) {
+		return false;
+	}
+	memcpy(src_addr, &hostRtcMem[des_addr * 4], save_size);
+	return true;
+}
+
+bool system_rtc_mem_write(uint8_t des_addr, const void* src_addr, uint16_t save_size) {
+	if ((des_addr < 64) || ((size_t) des_addr * 4 + save_size > sizeof(hostRtcMem))) {
+		return false;
+	}
+	memcpy(&hostRtcMem[des_addr * 4], src_addr, save_size);
+	return true;
+}
+
+#ifdef ESP8266
+extern "C" void ets_putc(char) {
+}
+
+extern "C" bool can_yield() {
+	return !hostInIsr;
+}
+#else
+extern "C" void ets_write_char_uart(char) {
+}
+#endif
+
+extern "C" void ets_install_putc1(void (*)(char)) {
+}
+
+#ifndef ESP8266
+int hostSpiramAllocs = 0;
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+	if (caps & MALLOC_CAP_SPIRAM) {
+		hostSpiramAllocs++;
+	}
+	return realloc(ptr, size);
+}
+
+// FreeRTOS
+
+struct HostTask {
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	uint32_t notified = 0;
+};
+
+struct HostSemaphore {
+	std::recursive_timed_mutex mutex;
+};
+
+static thread_local HostTask* hostCurrentTask = NULL;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char*, uint32_t, void* param,
+		uint32_t, TaskHandle_t* handle, BaseType_t) {
+	HostTask* task = new HostTask();
+	*handle = task;
+	task->thread = std::thread([task, code, param]() {
+		hostCurrentTask = task;
+		code(param);
+	});
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	if (!task) {
+		task = hostCurrentTask;
+	}
+	// The thread ends by returning from its function
+	task->thread.detach();
+	delete task;
+	if (task == hostCurrentTask) {
+		hostCurrentTask = NULL;
+	}
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+	return hostCurrentTask;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+	std::lock_guard<std::mutex> lock(task->mutex);
+	task->notified++;
+	task->cv.notify_one();
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t*) {
+	xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+	HostTask* task = hostCurrentTask;
+	std::unique_lock<std::mutex> lock(task->mutex);
+	// A tick of the simulated clock is a real 100 us
+	task->cv.wait_for(lock, std::chrono::microseconds((uint64_t) ticks * 100), [task]() { return task->notified > 0; });
+	uint32_t value = task->notified;
+	if (value > 0) {
+		task->notified = clear ? 0 : value - 1;
+	} else {
+		hostAdvance(ticks);
+	}
+	return value;
+}
+
+BaseType_t xPortInIsrContext() {
+	return hostInIsr;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+	return new HostSemaphore();
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+	return new HostSemaphore();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+	delete sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+	if (ticks == portMAX_DELAY) {
+		sem->mutex.lock();
+		return pdTRUE;
+	}
+	return sem->mutex.try_lock_for(std::chrono::microseconds((uint64_t) ticks * 100)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+	sem->mutex.unlock();
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks) {
+	return xSemaphoreTake(sem, ticks);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+	return xSemaphoreGive(sem);
+}
+#endif
@@ -0,0 +1,10 @@
+#ifndef TELNETSPY_HOST_USER_INTERFACE_H
+#define TELNETSPY_HOST_USER_INTERFACE_H
+
+#include <stdint.h>
+
+void system_set_os_print(uint8_t onoff);
+bool system_rtc_mem_read(uint8_t des_addr, void* src_addr, uint16_t save_size);
+bool system_rtc_mem_write(uint8_t des_addr, const void* src_addr, uint16_t save_size);
+
+#endif
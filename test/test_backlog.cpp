@@ -0,0 +1,49 @@
+/*
+ * The compressed backlog: lines written while offline are moved into the
+ * backlog when the transmit buffer is full, a new client gets them in order
+ * and without gaps (up to the oldest dropped block)
+ */
+
+#include "host_test.h"
+
+static void backlog(bool timestamps) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(1024);
+	spy.setBacklogSize(4096);
+	spy.setTimestamps(timestamps);
+	spy.begin(115200);
+	char line[64];
+	for (int i = 0; i < 2000; i++) {
+		snprintf(line, sizeof(line), "line %04d: value=%d state=%s\n", i, i % 17, (i % 5) ? "idle" : "busy");
+		spy.print(line);
+	}
+	TelnetSpyStats stats = spy.getStats();
+	CHECK(stats.bytesCompressed > 0);
+	CHECK(stats.compressedSize < stats.bytesCompressed);
+
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 500);
+	std::string text = conn->take();
+	CHECK(text.size() > 4096);
+	// The newest lines arrive without gaps
+	size_t pos = text.find("line ");
+	int next = atoi(&text[pos + 5]);
+	CHECK(next > 0);
+	while (pos != std::string::npos) {
+		CHECK_EQUAL(atoi(&text[pos + 5]), next);
+		CHECK((pos == 0) || (text[pos - 1] == (timestamps ? ' ' : '\n')));
+		next++;
+		pos = text.find("line ", pos + 1);
+	}
+	CHECK_EQUAL(next, 2000);
+}
+
+int main() {
+	backlog(false);
+	backlog(true);
+	puts("OK");
+	return 0;
+}
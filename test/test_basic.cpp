@@ -0,0 +1,38 @@
+/*
+ * The basic function: buffering while offline, mirroring to the serial port,
+ * sending to a telnet client and receiving from it
+ */
+
+#include "host_test.h"
+
+int main() {
+	TelnetSpy spy;
+	spy.setWelcomeMsg("welcome\r\n");
+	spy.begin(115200);
+	spy.print("offline\n");
+	runHandle(spy);
+	CHECK_EQUAL(Serial.output, "offline\n");
+	CHECK(!spy.isClientConnected());
+
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 200);
+	CHECK(spy.isClientConnected());
+	CHECK_EQUAL(conn->take(), "welcome\r\noffline\n");
+
+	spy.println("online");
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take(), "online\r\n");
+
+	conn->send("abc");
+	CHECK_EQUAL(spy.available(), 3);
+	char buf[4] = {};
+	CHECK_EQUAL(spy.readBytes(buf, 3), 3u);
+	CHECK_EQUAL(std::string(buf), "abc");
+	CHECK_EQUAL(spy.read(), -1);
+
+	conn->close();
+	runHandle(spy);
+	CHECK(!spy.isClientConnected());
+	puts("OK");
+	return 0;
+}
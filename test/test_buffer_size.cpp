@@ -0,0 +1,47 @@
+/*
+ * Changing the size of the transmit buffer while a client is connected and
+ * data is waiting in the buffer (wrapped around its end)
+ */
+
+#include "host_test.h"
+
+int main() {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(200);
+	spy.begin(115200);
+	std::shared_ptr<HostConnection> conn = hostConnect(0);
+	runHandle(spy);
+	CHECK(spy.isClientConnected());
+	for (int i = 0; i < 30; i++) {
+		spy.printf("line %02d\n", i);
+	}
+	conn->window = 50;
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take().size(), 50u);
+
+	// The buffered data is dropped, the data is sent directly
+	CHECK(spy.setBufferSize(0));
+	CHECK_EQUAL(spy.getBufferSize(), 0u);
+	runHandle(spy, 200);
+	CHECK(conn->take().empty());
+	conn->window = SIZE_MAX;
+	spy.print("direct\n");
+	runHandle(spy);
+	CHECK_EQUAL(conn->take(), "direct\n");
+
+	// A new buffer starts empty
+	CHECK(spy.setBufferSize(300));
+	spy.print("buffered\n");
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take(), "buffered\n");
+
+	spy.setBufferSize(0);
+	spy.disconnectClient();
+	runHandle(spy);
+	CHECK(!spy.isClientConnected());
+	puts("OK");
+	return 0;
+}
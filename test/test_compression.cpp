@@ -0,0 +1,148 @@
+/*
+ * COMPRESS2 round trip: the output is inflated by zlib for several sizes of
+ * the send window (of the loopback transport), with and without transmit
+ * buffer and with a transport which doesn't report its free space. The client
+ * ends the compression in the middle of the data, so the end of the stream
+ * (with its Adler-32) is checked too.
+ */
+
+#include "host_test.h"
+#include <zlib.h>
+
+// Splits the output into the telnet commands, the plain and the compressed data
+struct Client {
+	std::string text;
+	std::string commands;
+	bool compressed = false;
+	bool ended = false;
+	size_t compressedSize = 0;
+	size_t inflatedSize = 0;
+	z_stream z = {};
+
+	void feed(const std::string& data) {
+		size_t pos = 0;
+		while (pos < data.size()) {
+			if (compressed) {
+				uint8_t out[4096];
+				z.next_in = (Bytef*) &data[pos];
+				z.avail_in = data.size() - pos;
+				int ret;
+				do {
+					z.next_out = out;
+					z.avail_out = sizeof(out);
+					ret = inflate(&z, Z_SYNC_FLUSH);
+					CHECK((ret == Z_OK) || (ret == Z_STREAM_END) || (ret == Z_BUF_ERROR));
+					text.append((const char*) out, sizeof(out) - z.avail_out);
+					inflatedSize += sizeof(out) - z.avail_out;
+				} while ((ret == Z_OK) && (z.avail_in > 0));
+				compressedSize += data.size() - pos - z.avail_in;
+				pos = data.size() - z.avail_in;
+				if (ret == Z_STREAM_END) {
+					inflateEnd(&z);
+					compressed = false;
+					ended = true;
+				}
+			} else if ((uint8_t) data[pos] == 255) {
+				// IAC WILL COMPRESS2 or IAC SB COMPRESS2 IAC SE
+				if (data.compare(pos, 5, "\xff\xfa\x56\xff\xf0") == 0) {
+					CHECK_EQUAL(inflateInit(&z), Z_OK);
+					compressed = true;
+					pos += 5;
+				} else {
+					commands += data.substr(pos, 3);
+					pos += 3;
+				}
+			} else {
+				text += data[pos++];
+			}
+		}
+	}
+};
+
+// Hides its free space (as the WiFi transport of ESP32), so the writes are cut
+class BlindTransport : public TelnetSpyLoopbackTransport {
+	public:
+		BlindTransport(size_t window, bool hide) : TelnetSpyLoopbackTransport(window), blind(hide) {}
+		int availableForWrite(uint8_t slot) override {
+			return blind ? -1 : TelnetSpyLoopbackTransport::availableForWrite(slot);
+		}
+		bool blind;
+};
+
+static std::string makeLine(int i) {
+	char line[64];
+	snprintf(line, sizeof(line), "line %d: temperature=%d.%d status=%s\n", i, 20 + i % 7, i % 10,
+			(i % 3) ? "ok" : "warning");
+	return line;
+}
+
+static void roundTrip(size_t window, size_t bufferSize, bool blind = false) {
+	// The spy stops the transport in its destructor, so the transport is
+	// destroyed after it
+	BlindTransport loopback(window, blind);
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setCompression(true);
+	spy.setBufferSize(bufferSize);
+	spy.setTransport(&loopback);
+	spy.begin(115200);
+	loopback.connectClient();
+	Client client;
+	auto receive = [&]() {
+		uint8_t buf[256];
+		size_t n;
+		while ((n = loopback.output(0, buf, sizeof(buf))) > 0) {
+			client.feed(std::string((const char*) buf, n));
+		}
+	};
+	auto drain = [&](size_t expected) {
+		for (int i = 0; (i < 100000) && ((i < 200) || (client.text.size() < expected)); i++) {
+			hostAdvance(1);
+			spy.handle();
+			receive();
+		}
+		CHECK_EQUAL(client.text.size(), expected);
+	};
+	drain(0);
+	CHECK_EQUAL(client.commands, std::string("\xff\xfb\x56"));
+	loopback.input(0, (const uint8_t*) "\xff\xfd\x56", 3);
+	drain(0);
+	std::string expected;
+	for (int i = 0; i < 300; i++) {
+		if (i == 200) {
+			drain(expected.size());
+			CHECK(client.compressed);
+			loopback.input(0, (const uint8_t*) "\xff\xfe\x56", 3);
+		}
+		expected += makeLine(i);
+		spy.print(makeLine(i).c_str());
+		if (bufferSize == 0) {
+			receive();
+		}
+	}
+	drain(expected.size());
+	CHECK(client.ended);
+	CHECK(!client.compressed);
+	CHECK_EQUAL(client.text, expected);
+	printf("window %zu%s, buffer %zu: %zu bytes compressed to %zu\n", window, blind ? " (hidden)" : "",
+			bufferSize, client.inflatedSize, client.compressedSize);
+	CHECK(client.inflatedSize > 0);
+	if (window >= 536) {
+		// Small windows need many flushes (up to 7 bytes each)
+		CHECK(client.compressedSize < client.inflatedSize * 3 / 4);
+	}
+}
+
+int main() {
+	const size_t windows[] = { 40, 100, 536, 1460, 5744 };
+	for (size_t window : windows) {
+		roundTrip(window, 16384);
+	}
+	roundTrip(1460, 0);
+	roundTrip(100, 16384, true);
+	roundTrip(1460, 16384, true);
+	puts("OK");
+	return 0;
+}
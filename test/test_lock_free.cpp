@@ -0,0 +1,87 @@
+/*
+ * Stress test of the ring buffer with a writer and a sender in different
+ * threads: with TELNETSPY_LOCK_FREE handle() runs in a second thread, else
+ * the ESP32 task sends the data. The lines must arrive complete and in order,
+ * lines may be dropped if the buffer is full.
+ */
+
+#include "host_test.h"
+#include <atomic>
+#include <thread>
+
+#define STRESS_LINES 300000
+
+int main() {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(4096);
+	spy.begin(115200);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy);
+	CHECK(spy.isClientConnected());
+
+	std::atomic<bool> done(false);
+#ifdef TELNETSPY_LOCK_FREE
+	std::thread sender([&spy, &done]() {
+		while (!done) {
+			hostAdvance(1);
+			spy.handle();
+		}
+	});
+#else
+	CHECK(spy.startTask());
+#endif
+	std::string text;
+	long next = 0;
+	long received = 0;
+	size_t bytes = 0;
+	auto parse = [&]() {
+		text += conn->take();
+		size_t pos = 0;
+		size_t end;
+		while ((end = text.find('\n', pos)) != std::string::npos) {
+			std::string line = text.substr(pos, end - pos);
+			pos = end + 1;
+			bytes += line.size() + 1;
+			long n;
+			CHECK_EQUAL(sscanf(line.c_str(), "%ld", &n), 1);
+			CHECK_EQUAL(line, line.substr(0, 8) + ((n & 1) ? " odd" : " even line"));
+			CHECK(n >= next);
+			next = n + 1;
+			received++;
+		}
+		text.erase(0, pos);
+	};
+	for (int i = 0; i < STRESS_LINES; i++) {
+		spy.printf("%08d %s\n", i, (i & 1) ? "odd" : "even line");
+		if ((i % 1000) == 0) {
+			parse();
+		}
+	}
+	done = true;
+#ifdef TELNETSPY_LOCK_FREE
+	sender.join();
+	runHandle(spy, 300);
+#else
+	spy.flush();
+	for (int i = 0; (i < 1000) && (next < STRESS_LINES); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		parse();
+	}
+	spy.stopTask();
+#endif
+	parse();
+	CHECK(text.empty());
+	printf("received %ld of %d lines\n", received, STRESS_LINES);
+	CHECK(received > 0);
+#ifdef TELNETSPY_LOCK_FREE
+	// Lines which did not fit are dropped completely
+	CHECK_EQUAL(bytes + spy.getStats().bytesDiscarded, (size_t) STRESS_LINES / 2 * (13 + 19));
+#else
+	CHECK_EQUAL(next, STRESS_LINES);
+#endif
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Fuzz test of the telnet NVT parser: a random mix of data, escaped 0xff,
+ * commands, option negotiations and subnegotiations, split into random
+ * fragments, must give the same data and commands as the unsplit stream
+ */
+
+#include "host_test.h"
+
+#define FUZZ_TOKENS 20000
+
+static std::string events;
+
+static void onBRK() { events += "BRK "; }
+static void onIP() { events += "IP "; }
+static void onAO() { events += "AO "; }
+static void onAYT() { events += "AYT "; }
+static void onEC() { events += "EC "; }
+static void onEL() { events += "EL "; }
+static void onGA() { events += "GA "; }
+static void onWWDD(char command, char option) {
+	char tmp[16];
+	snprintf(tmp, sizeof(tmp), "%u/%u ", (uint8_t) command, (uint8_t) option);
+	events += tmp;
+}
+
+// Builds the stream with the expected data and commands
+static std::string makeStream(std::string* data, std::string* commands) {
+	static const char* names[] = { "BRK ", "IP ", "AO ", "AYT ", "EC ", "EL ", "GA " };
+	std::string s;
+	for (int t = 0; t < FUZZ_TOKENS; t++) {
+		int kind = rand() % 10;
+		if (kind < 5) {
+			// Data without IAC
+			int n = 1 + rand() % 20;
+			for (int i = 0; i < n; i++) {
+				char c = rand() % 255;
+				s += c;
+				*data += c;
+			}
+		} else if (kind == 5) {
+			// Escaped 0xff
+			s += "\xff\xff";
+			*data += '\xff';
+		} else if (kind == 6) {
+			// BRK ... GA
+			int cmd = rand() % 7;
+			s += '\xff';
+			s += (char) (243 + cmd);
+			*commands += names[cmd];
+		} else if (kind == 7) {
+			// NOP and DM are ignored
+			s += '\xff';
+			s += (char) (241 + rand() % 2);
+		} else if (kind == 8) {
+			// WILL, WON'T, DO or DON'T with any option (but COMPRESS2)
+			uint8_t cmd = 251 + rand() % 4;
+			uint8_t option = rand() % 256;
+			if (option == 86) {
+				option = 255;
+			}
+			s += '\xff';
+			s += (char) cmd;
+			s += (char) option;
+			char tmp[16];
+			snprintf(tmp, sizeof(tmp), "%u/%u ", cmd, option);
+			*commands += tmp;
+		} else {
+			// Subnegotiation, its data (with escaped 0xff) is ignored
+			s += "\xff\xfa";
+			int n = rand() % 12;
+			for (int i = 0; i < n; i++) {
+				char c = rand() % 256;
+				s += c;
+				if (c == '\xff') {
+					s += c;
+				}
+			}
+			s += "\xff\xf0";
+		}
+	}
+	return s;
+}
+
+// Sends the stream in fragments of 1 ... maxFragment bytes
+static void run(const std::string& stream, size_t maxFragment, std::string* data) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	// A full receive buffer would lose data
+	CHECK(spy.setRecBufferSize(stream.size()));
+	spy.setCallbackOnNvtBRK(onBRK);
+	spy.setCallbackOnNvtIP(onIP);
+	spy.setCallbackOnNvtAO(onAO);
+	spy.setCallbackOnNvtAYT(onAYT);
+	spy.setCallbackOnNvtEC(onEC);
+	spy.setCallbackOnNvtEL(onEL);
+	spy.setCallbackOnNvtGA(onGA);
+	spy.setCallbackOnNvtWWDD(onWWDD);
+	spy.begin(115200);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 10);
+	CHECK(spy.isClientConnected());
+	events.clear();
+	for (size_t pos = 0; pos < stream.size(); ) {
+		size_t n = std::min(stream.size() - pos, 1 + rand() % maxFragment);
+		conn->send(stream.substr(pos, n));
+		pos += n;
+		spy.handle();
+		while (spy.available() > 0) {
+			*data += (char) spy.read();
+		}
+	}
+	CHECK(spy.isClientConnected());
+}
+
+int main() {
+	srand(1);
+	std::string data;
+	std::string commands;
+	std::string stream = makeStream(&data, &commands);
+	size_t fragments[] = { 1, 2, 3, 7, 64, 1000, 100000 };
+	for (size_t maxFragment : fragments) {
+		std::string received;
+		run(stream, maxFragment, &received);
+		CHECK(received == data);
+		CHECK(events == commands);
+	}
+	puts("OK");
+	return 0;
+}
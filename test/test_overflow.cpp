@@ -0,0 +1,61 @@
+/*
+ * TELNETSPY_OVERFLOW_BLOCK only waits where waiting is possible: not while no
+ * client is connected, not in interrupts and not in the callbacks of handle()
+ */
+
+#include "host_test.h"
+
+static TelnetSpy* spyRef;
+
+static void fill() {
+	for (int i = 0; i < 100; i++) {
+		spyRef->printf("line %03d: 0123456789\n", i);
+	}
+}
+
+int main() {
+	TelnetSpyLoopbackTransport loopback(100);
+	TelnetSpy spy;
+	spyRef = &spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(500);
+	spy.setTransport(&loopback);
+	spy.begin(115200);
+
+	// No client: the oldest lines are dropped
+	spy.setOverflowPolicy(TELNETSPY_OVERFLOW_BLOCK, 5);
+	fill();
+	CHECK_EQUAL(spy.getStats().blockCount, 0u);
+
+	// The client doesn't take data: waits once until the timeout
+	loopback.connectClient();
+	runHandle(spy, 10);
+	fill();
+	CHECK_EQUAL(spy.getStats().blockCount, 1u);
+	CHECK_EQUAL(spy.getStats().blockTimeouts, 1u);
+
+	// Interrupt
+	spy.setOverflowPolicy(TELNETSPY_OVERFLOW_BLOCK, 5);
+	hostInIsr = true;
+	fill();
+	hostInIsr = false;
+	CHECK_EQUAL(spy.getStats().blockCount, 1u);
+
+	// Callback of handle()
+	spy.setOverflowPolicy(TELNETSPY_OVERFLOW_BLOCK, 5);
+	spy.setCallbackOnConnect(fill);
+	loopback.disconnectClient(0);
+	runHandle(spy, 10);
+	loopback.connectClient();
+	runHandle(spy, 10);
+	CHECK_EQUAL(spy.getStats().connects, 2u);
+	CHECK_EQUAL(spy.getStats().blockCount, 1u);
+
+	// Waits again outside
+	fill();
+	CHECK_EQUAL(spy.getStats().blockCount, 2u);
+	puts("OK");
+	return 0;
+}
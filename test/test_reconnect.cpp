@@ -0,0 +1,57 @@
+/*
+ * A client which disconnects in the middle of a line must not leave its
+ * position behind: the slot's cursors are reset, so the eviction while
+ * offline and the next client of the slot work as if it never existed
+ */
+
+#include "host_test.h"
+
+int main() {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(200);
+	spy.setTimestamps(true);
+	spy.setPriorityEviction(true);
+	spy.begin(115200);
+
+	// The first client gets a part of the timestamp only
+	std::shared_ptr<HostConnection> conn = hostConnect(5);
+	runHandle(spy);
+	CHECK(spy.isClientConnected());
+	spy.setSeverity(TELNETSPY_SEVERITY_DEBUG);
+	spy.print("line00\n");
+	spy.setSeverity(TELNETSPY_SEVERITY_INFO);
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take().size(), 5u);
+	conn->close();
+	runHandle(spy);
+	CHECK(!spy.isClientConnected());
+
+	// Offline the debug line and then the oldest lines are evicted
+	char line[16];
+	for (int i = 1; i < 40; i++) {
+		snprintf(line, sizeof(line), "line%02d\n", i);
+		spy.print(line);
+	}
+	conn = hostConnect();
+	runHandle(spy, 200);
+	CHECK(spy.isClientConnected());
+	std::string text = conn->take();
+	CHECK(text.find("line00") == std::string::npos);
+	CHECK(text.find("line39\n") != std::string::npos);
+	// The remaining lines are complete and without gaps
+	CHECK_EQUAL(text[0], '[');
+	size_t pos = text.find("] line");
+	int next = atoi(text.substr(pos + 6, 2).c_str());
+	while (pos != std::string::npos) {
+		CHECK_EQUAL(atoi(text.substr(pos + 6, 2).c_str()), next);
+		CHECK_EQUAL(text.substr(pos + 8, 2), next < 39 ? "\n[" : "\n");
+		next++;
+		pos = text.find("] line", pos + 1);
+	}
+	CHECK_EQUAL(next, 40);
+	puts("OK");
+	return 0;
+}
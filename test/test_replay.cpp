@@ -0,0 +1,111 @@
+/*
+ * Replay with a budget: a new client gets the live data in every call of
+ * handle() while the buffered lines are replayed within the budget, the
+ * lines of both are not mixed up and the end of the replay is marked
+ */
+
+#include "host_test.h"
+
+#define REPLAY_BUDGET 64
+
+static void replay(bool timestamps) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(8192);
+	spy.setTimestamps(timestamps);
+	spy.setReplayBudget(REPLAY_BUDGET);
+	spy.begin(115200);
+	char line[32];
+	for (int i = 0; i < 100; i++) {
+		snprintf(line, sizeof(line), "old %03d\n", i);
+		spy.print(line);
+	}
+	runHandle(spy);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy);
+	CHECK(spy.isClientConnected());
+
+	std::string text = conn->take();
+	CHECK((text.size() > 0) && (text.size() <= REPLAY_BUDGET));
+	int nextOld = 0;
+	int nextLive = 0;
+	bool marked = false;
+	for (int round = 0; (round < 1000) && (nextLive < 100); round++) {
+		CHECK(marked || (round < 100));
+		if (round < 100) {
+			snprintf(line, sizeof(line), "live %03d\n", round);
+			spy.print(line);
+		}
+		hostAdvance(1);
+		spy.handle();
+		std::string data = conn->take();
+		text += data;
+		// The live lines are sent completely, the rest is the replay
+		size_t replayed = data.size();
+		size_t end;
+		while ((end = text.find('\n')) != std::string::npos) {
+			std::string l = text.substr(0, end + 1);
+			text.erase(0, end + 1);
+			if (l == TELNETSPY_LIVE_MSG) {
+				CHECK(!marked);
+				CHECK_EQUAL(nextOld, 100);
+				marked = true;
+				replayed -= l.size();
+				continue;
+			}
+			CHECK_EQUAL(l[0] == '[', timestamps);
+			size_t pos = l.find("old ");
+			if (pos != std::string::npos) {
+				CHECK(!marked);
+				CHECK_EQUAL(atoi(&l[pos + 4]), nextOld);
+				nextOld++;
+				continue;
+			}
+			pos = l.find("live ");
+			CHECK(pos != std::string::npos);
+			CHECK_EQUAL(atoi(&l[pos + 5]), nextLive);
+			nextLive++;
+			replayed -= l.size();
+		}
+		// During the replay the live line is sent in the same call of handle()
+		// (afterwards the lines are collected as usual)
+		if (!marked) {
+			CHECK_EQUAL(nextLive, round + 1);
+		}
+		CHECK(replayed <= REPLAY_BUDGET);
+	}
+	CHECK(marked);
+	CHECK_EQUAL(nextOld, 100);
+	CHECK_EQUAL(nextLive, 100);
+}
+
+static void replayPartialLine() {
+	// The rest of a line which is incomplete at the connect follows the replay
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setReplayBudget(REPLAY_BUDGET);
+	spy.begin(115200);
+	for (int i = 0; i < 20; i++) {
+		spy.print("old line\n");
+	}
+	spy.print("part");
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy);
+	spy.print("ial\nlive\n");
+	runHandle(spy, 200);
+	std::string text = conn->take();
+	CHECK_EQUAL(text.substr(text.size() - 15 - strlen(TELNETSPY_LIVE_MSG)),
+			std::string("part\r\n") + TELNETSPY_LIVE_MSG + "ial\nlive\n");
+}
+
+int main() {
+	replay(false);
+	replay(true);
+	replayPartialLine();
+	puts("OK");
+	return 0;
+}
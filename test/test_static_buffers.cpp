@@ -0,0 +1,38 @@
+/*
+ * Static arrays as buffers (given to the constructor): setBufferSize and
+ * setRecBufferSize work up to their sizes
+ */
+
+#include "host_test.h"
+
+int main() {
+	static char buf[1024];
+	static char recBuf[32];
+	TelnetSpy spy(buf, sizeof(buf), recBuf, sizeof(recBuf));
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.begin(115200);
+	CHECK_EQUAL(spy.getBufferSize(), 1024u);
+	CHECK_EQUAL(spy.getRecBufferSize(), 32u);
+	CHECK(!spy.setBufferSize(2048));
+	CHECK_EQUAL(spy.getBufferSize(), 1024u);
+	CHECK(!spy.setRecBufferSize(64));
+
+	// Shrinking keeps the youngest lines
+	for (int i = 0; i < 100; i++) {
+		spy.printf("line %02d\n", i);
+	}
+	CHECK(spy.setBufferSize(80));
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take(), "line 90\nline 91\nline 92\nline 93\nline 94\nline 95\nline 96\nline 97\nline 98\nline 99\n");
+
+	// And it grows again up to the given size
+	CHECK(spy.setBufferSize(1024));
+	spy.print("online\n");
+	runHandle(spy, 200);
+	CHECK_EQUAL(conn->take(), "online\n");
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * The transmit buffer survives a restart in a storage: saved by saveBuffer,
+ * periodically and before the restart by "Interrupt Process", validated and
+ * put in front of the transmit buffer of the next run
+ */
+
+#include "host_test.h"
+#include <FS.h>
+#include <unistd.h>
+
+static const char* restartMsg = TELNETSPY_RESTART_MSG;
+
+// Connects a client to a new TelnetSpy with the storage, returns what it gets
+static std::string restore(TelnetSpyStorage* storage, bool* restored, bool timestamps = false) {
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setTimestamps(timestamps);
+	spy.begin(115200);
+	*restored = spy.setStorage(storage);
+	spy.setStorage(NULL);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 200);
+	return conn->take();
+}
+
+static void fileStorage() {
+	char path[64];
+	snprintf(path, sizeof(path), "test_storage_%d.bin", (int) getpid());
+	fs::FS fileSystem;
+	fileSystem.remove(path);
+	TelnetSpyFileStorage storage(fileSystem, path, 100);
+	bool restored;
+	CHECK_EQUAL(restore(&storage, &restored), "");
+	CHECK(!restored);
+	{
+		TelnetSpy spy;
+		spy.setSerial(NULL);
+		spy.begin(115200);
+		spy.setStorage(&storage);
+		spy.setSaveTime(0);
+		for (int i = 0; i < 20; i++) {
+			spy.printf("line %02d\n", i);
+		}
+		CHECK(spy.saveBuffer());
+		spy.setStorage(NULL);
+	}
+	// Only the youngest complete lines fit (100 - 16 bytes of header)
+	std::string expected;
+	for (int i = 10; i < 20; i++) {
+		char line[16];
+		snprintf(line, sizeof(line), "line %02d\n", i);
+		expected += line;
+	}
+	CHECK_EQUAL(restore(&storage, &restored), expected + restartMsg);
+	CHECK(restored);
+
+	// A changed byte is detected by the checksum
+	FILE* f = fopen(path, "r+b");
+	CHECK(f);
+	fseek(f, 20, SEEK_SET);
+	fputc('X', f);
+	fclose(f);
+	CHECK_EQUAL(restore(&storage, &restored), "");
+	CHECK(!restored);
+	fileSystem.remove(path);
+}
+
+static void rtcStorage() {
+	TelnetSpyRtcStorage storage(0, 256);
+	{
+		// Saved periodically, the last line is written after the save
+		TelnetSpy spy;
+		spy.setSerial(NULL);
+		spy.setTimestamps(true);
+		spy.begin(115200);
+		spy.setStorage(&storage);
+		spy.setSaveTime(50);
+		spy.print("saved\n");
+		runHandle(spy, 60);
+		spy.print("lost\n");
+		spy.setStorage(NULL);
+	}
+	bool restored;
+	std::string text = restore(&storage, &restored, true);
+	CHECK(restored);
+	// "[00:00:00.000] saved\n" with the timestamps of the last run
+	CHECK_EQUAL(text.size(), 15 + 6 + strlen(restartMsg));
+	CHECK_EQUAL(text.substr(0, 1), "[");
+	CHECK_EQUAL(text.substr(15), std::string("saved\n") + restartMsg);
+}
+
+static void interruptProcess() {
+	TelnetSpyRtcStorage storage(0, 256);
+	int restarts = hostRestarts;
+	{
+		TelnetSpy spy;
+		spy.setSerial(NULL);
+		spy.setWelcomeMsg("");
+		spy.setPingTime(0);
+		spy.begin(115200);
+		spy.setStorage(&storage);
+		spy.setSaveTime(0);
+		std::shared_ptr<HostConnection> conn = hostConnect();
+		runHandle(spy, 200);
+		// The data which isn't sent yet is saved
+		conn->window = 0;
+		spy.print("before the crash\n");
+		runHandle(spy, 200);
+		conn->send("\xff\xf4");
+		runHandle(spy, 10);
+		spy.setStorage(NULL);
+	}
+	CHECK_EQUAL(hostRestarts, restarts + 1);
+	bool restored;
+	CHECK_EQUAL(restore(&storage, &restored), std::string("before the crash\n") + restartMsg);
+	CHECK(restored);
+}
+
+// Writes to the spy during the first writes of a save, as an interrupt would
+class RacingStorage : public TelnetSpyRtcStorage {
+	public:
+		RacingStorage(TelnetSpy* s) : TelnetSpyRtcStorage(0, 256), spy(s), races(0) {}
+		bool write(uint16_t offset, const uint8_t* data, uint16_t len) override {
+			if ((offset > 0) && (races > 0)) {
+				races--;
+				for (int i = 0; i < 14; i++) {
+					spy->printf("new %02d\n", i);
+				}
+			}
+			return TelnetSpyRtcStorage::write(offset, data, len);
+		}
+		TelnetSpy* spy;
+		int races;
+};
+
+static void changedWhileSaving() {
+	TelnetSpy spy;
+	RacingStorage storage(&spy);
+	spy.setSerial(NULL);
+	spy.setBufferSize(128);
+	spy.begin(115200);
+	spy.setStorage(&storage);
+	spy.setSaveTime(0);
+	for (int i = 0; i < 16; i++) {
+		spy.printf("old %02d\n", i);
+	}
+	// Most old lines are dropped by the writes during the first copy, the
+	// second copy doesn't mix them with the new lines
+	storage.races = 1;
+	CHECK(spy.saveBuffer());
+	std::string expected = "old 12\nold 13\nold 14\nold 15\n";
+	for (int i = 0; i < 14; i++) {
+		char line[16];
+		snprintf(line, sizeof(line), "new %02d\n", i);
+		expected += line;
+	}
+	bool restored;
+	CHECK_EQUAL(restore(&storage, &restored), expected + restartMsg);
+	CHECK(restored);
+	// Changed during every try
+	storage.races = TELNETSPY_SAVE_TRIES;
+	CHECK(!spy.saveBuffer());
+	spy.setStorage(NULL);
+}
+
+static void fullBuffer() {
+	TelnetSpyRtcStorage storage(0, 256);
+	{
+		TelnetSpy spy;
+		spy.setSerial(NULL);
+		spy.begin(115200);
+		spy.setStorage(&storage);
+		spy.print("saved\n");
+		CHECK(spy.saveBuffer());
+		spy.setStorage(NULL);
+	}
+	// The oldest lines are dropped for the restart message
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(64);
+	spy.begin(115200);
+	for (int i = 0; i < 8; i++) {
+		spy.printf("line %02d\n", i);
+	}
+	CHECK(spy.setStorage(&storage));
+	spy.setStorage(NULL);
+	std::shared_ptr<HostConnection> conn = hostConnect();
+	runHandle(spy, 200);
+	std::string text = conn->take();
+	CHECK_EQUAL(text.substr(0, strlen(restartMsg)), restartMsg);
+	CHECK_EQUAL(text.substr(text.size() - 8), "line 07\n");
+	// Too small for the message
+	spy.setMinBlockSize(16);
+	spy.setBufferSize(16);
+	CHECK(!spy.setStorage(&storage));
+	spy.setStorage(NULL);
+}
+
+int main() {
+	fileStorage();
+	rtcStorage();
+	interruptProcess();
+	changedWhileSaving();
+	fullBuffer();
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * The syslog transport sends every line as one RFC 5424 message in its own
+ * UDP datagram (RFC 5426), with the severity of the line in the PRI. A UDP
+ * listener on 127.0.0.1 receives the datagrams.
+ */
+
+#include "host_test.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static int listener;
+
+static uint16_t listen() {
+	listener = socket(AF_INET, SOCK_DGRAM, 0);
+	CHECK(listener >= 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CHECK(bind(listener, (sockaddr*) &addr, sizeof(addr)) == 0);
+	socklen_t len = sizeof(addr);
+	CHECK(getsockname(listener, (sockaddr*) &addr, &len) == 0);
+	return ntohs(addr.sin_port);
+}
+
+// Returns the datagrams which arrived, each as "PRI|MSG"
+static std::vector<std::string> receive() {
+	std::vector<std::string> msgs;
+	pollfd fd = { listener, POLLIN, 0 };
+	while (poll(&fd, 1, 50) > 0) {
+		char buf[2048];
+		ssize_t n = recv(listener, buf, sizeof(buf), 0);
+		CHECK(n > 0);
+		std::string d(buf, n);
+		// "<PRI>1 TIMESTAMP HOSTNAME APP-NAME - - - MSG"
+		CHECK(d[0] == '<');
+		size_t end = d.find(">1 ");
+		CHECK(end != std::string::npos);
+		size_t hdr = d.find(" host app - - - ");
+		CHECK(hdr != std::string::npos);
+		msgs.push_back(d.substr(1, end - 1) + "|" + d.substr(hdr + 16));
+	}
+	return msgs;
+}
+
+static void severities(bool timestamps, bool buffer) {
+	TelnetSpySyslogTransport syslog(IPAddress(127, 0, 0, 1), listen(), "host", "app");
+	syslog.setRateLimit(0);
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	if (!buffer) {
+		spy.setBufferSize(0);
+	}
+	spy.setTimestamps(timestamps);
+	spy.setTransport(&syslog);
+	spy.begin(115200);
+	runHandle(spy, 10);
+	CHECK(spy.isClientConnected());
+	// Several lines in one block, each with its own severity
+	spy.setSeverity(TELNETSPY_SEVERITY_DEBUG);
+	spy.print("debug\n");
+	spy.setSeverity(TELNETSPY_SEVERITY_INFO);
+	spy.print("info\n");
+	spy.setSeverity(TELNETSPY_SEVERITY_WARNING);
+	spy.print("warn");
+	spy.setSeverity(TELNETSPY_SEVERITY_ERROR);
+	spy.print("ing\n");
+	// An empty line isn't sent (with timestamps it isn't empty)
+	spy.print(timestamps ? "error\n" : "error\n\n");
+	runHandle(spy, 200);
+	std::vector<std::string> msgs = receive();
+	CHECK_EQUAL(msgs.size(), 4u);
+	CHECK_EQUAL(syslog.getDatagramCount(), 4u);
+	const char* expected[] = { "135|debug", "134|info", "132|warning", "131|error" };
+	for (int i = 0; i < 4; i++) {
+		std::string msg = msgs[i];
+		if (timestamps && buffer) {
+			// "[00:00:00.010] "
+			CHECK_EQUAL(msg.substr(4, 1), "[");
+			msg.erase(4, 15);
+		}
+		CHECK_EQUAL(msg, expected[i]);
+	}
+	close(listener);
+}
+
+// Gets the severity marks as the syslog transport, in memory
+class MarkedTransport : public TelnetSpyLoopbackTransport {
+	public:
+		MarkedTransport() : TelnetSpyLoopbackTransport(1000) {}
+		bool lineSeverities() override {
+			return true;
+		}
+};
+
+static void marks() {
+	// Without buffer, the severity is marked at the start of the lines only
+	MarkedTransport loopback;
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setBufferSize(0);
+	spy.setTransport(&loopback);
+	spy.begin(115200);
+	loopback.connectClient();
+	runHandle(spy, 10);
+	spy.setSeverity(TELNETSPY_SEVERITY_WARNING);
+	for (const char* p = "bytes\n"; *p; p++) {
+		spy.write((uint8_t) *p);
+	}
+	spy.setSeverity(TELNETSPY_SEVERITY_ERROR);
+	spy.print("abc");
+	spy.setSeverity(TELNETSPY_SEVERITY_INFO);
+	spy.print("def\nghi\n");
+	uint8_t buf[100];
+	size_t n = loopback.output(0, buf, sizeof(buf));
+	CHECK_EQUAL(std::string((const char*) buf, n), std::string("\xff\x02" "bytes\n" "\xff\x03" "abc" "def\n" "\xff\x01" "ghi\n"));
+}
+
+static void split() {
+	// Lines longer than the MTU are split, the rate limit keeps the rest in
+	// the transmit buffer
+	TelnetSpySyslogTransport syslog(IPAddress(127, 0, 0, 1), listen(), "host", "app");
+	CHECK(syslog.setMtu(200));
+	syslog.setRateLimit(5);
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setTransport(&syslog);
+	spy.begin(115200);
+	runHandle(spy, 10);
+	std::string longLine(300, 'x');
+	spy.print((longLine + "\n").c_str());
+	for (int i = 0; i < 10; i++) {
+		spy.printf("line %d\n", i);
+	}
+	runHandle(spy, 200);
+	std::vector<std::string> msgs = receive();
+	// The burst of 5 datagrams and one more after 200 ms
+	CHECK_EQUAL(msgs.size(), 6u);
+	CHECK(msgs[0].size() < 200);
+	CHECK_EQUAL(msgs[0].substr(4) + msgs[1].substr(4), longLine);
+	CHECK_EQUAL(msgs[2], "134|line 0");
+	runHandle(spy, 2000);
+	std::vector<std::string> rest = receive();
+	CHECK_EQUAL(rest.size(), 6u);
+	CHECK_EQUAL(rest[5], "134|line 9");
+	close(listener);
+}
+
+int main() {
+	severities(false, true);
+	severities(true, true);
+	severities(false, false);
+	marks();
+	split();
+	puts("OK");
+	return 0;
+}
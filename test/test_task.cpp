@@ -0,0 +1,52 @@
+/*
+ * The ESP32 task sleeps while nothing happens: a transport with events wakes
+ * it on connects and disconnects, write() on new data. The simulated clock
+ * advances only by the timeouts of the task, so it stands still while the
+ * task sleeps without a deadline.
+ */
+
+#include "host_test.h"
+#include <thread>
+
+// Waits up to a real second for the condition
+template <typename F> static bool waitFor(F condition) {
+	for (int i = 0; (i < 1000) && !condition(); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return condition();
+}
+
+int main() {
+	TelnetSpyLoopbackTransport loopback(1000);
+	TelnetSpy spy;
+	spy.setSerial(NULL);
+	spy.setWelcomeMsg("");
+	spy.setPingTime(0);
+	spy.setTransport(&loopback);
+	spy.begin(115200);
+	CHECK(spy.startTask());
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	unsigned long start = millis();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK_EQUAL(millis(), start);
+
+	loopback.connectClient();
+	CHECK(waitFor([&]() { return spy.isClientConnected(); }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	start = millis();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK_EQUAL(millis(), start);
+
+	// The data is sent after the collecting time
+	spy.print("hello\n");
+	CHECK(waitFor([&]() { return loopback.getSent(0) >= 6; }));
+	uint8_t buf[16];
+	size_t n = loopback.output(0, buf, sizeof(buf));
+	CHECK_EQUAL(std::string((const char*) buf, n), "hello\n");
+
+	loopback.disconnectClient(0);
+	CHECK(waitFor([&]() { return !spy.isClientConnected(); }));
+	spy.stopTask();
+	puts("OK");
+	return 0;
+}